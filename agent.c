@@ -0,0 +1,141 @@
+/*
+ * Messages between webbench --coordinator and its --agent processes, on
+ * a TCP connection each: a header of magic, type and payload length,
+ * then the payload. Counters and histograms go over as they are in
+ * memory, so coordinator and agents must be the same version of webbench
+ * on the same architecture; the magic and the version sent with the run
+ * catch the most of a mismatch.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#define AGENT_MAGIC 0x57424e43 /* WBNC */
+#define AGENT_MAX   (16 << 20) /* longest payload taken */
+
+#define AGENT_HANDSHAKE 15 /* sec, for a run to be sent, set up and started */
+#define AGENT_GRACE     30 /* sec past the benchmark time, for the results */
+
+/* message types */
+#define AGENT_RUN    1 /* coordinator: the arguments of the run, each '\0' terminated */
+#define AGENT_READY  2 /* agent: set up, starts on AGENT_GO */
+#define AGENT_GO     3 /* coordinator: start now */
+#define AGENT_SAMPLE 4 /* agent: the counts of a second */
+#define AGENT_DONE   5 /* agent: the totals and histograms */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t len; /* of the payload that follows */
+} agent_header_t;
+
+/* write all of the iovecs, on a blocking socket */
+static int agent_writev(int fd, struct iovec *iov, int n)
+{
+    ssize_t done;
+
+    while (n > 0) {
+        done = writev(fd, iov, n);
+        if (done < 0 && errno == EINTR)
+            continue;
+
+        if (done <= 0)
+            return -1;
+
+        for ( ; n > 0 && (size_t) done >= iov->iov_len; iov++, n--)
+            done -= iov->iov_len;
+
+        if (n > 0) {
+            iov->iov_base = (char *) iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+
+    return 0;
+}
+
+static int agent_read(int fd, void *buf, size_t len)
+{
+    ssize_t n;
+    char *p = (char *) buf;
+
+    while (len > 0) {
+        n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return -1;
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* reads and writes on fd fail after sec without progress, 0 for never */
+int agent_timeout(int fd, int sec)
+{
+    struct timeval tv;
+
+    tv.tv_sec = sec;
+    tv.tv_usec = 0;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)))
+        return -1;
+
+    return setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/* returns 0, or -1 on error */
+int agent_send(int fd, uint32_t type, const void *data, size_t len)
+{
+    agent_header_t h;
+    struct iovec iov[2];
+
+    h.magic = AGENT_MAGIC;
+    h.type = type;
+    h.len = (uint32_t) len;
+
+    iov[0].iov_base = &h;
+    iov[0].iov_len = sizeof(h);
+    iov[1].iov_base = (void *) data;
+    iov[1].iov_len = len;
+
+    return agent_writev(fd, iov, 2);
+}
+
+/*
+ * Waits for the next message. Its payload is returned in *data, to be
+ * freed by the caller, and has a '\0' after its *len bytes. 0, or -1 at
+ * the end of the connection, on error or on a message that is not ours.
+ */
+int agent_recv(int fd, uint32_t *type, char **data, size_t *len)
+{
+    agent_header_t h;
+
+    *data = NULL;
+    if (agent_read(fd, &h, sizeof(h)) || h.magic != AGENT_MAGIC || h.len > AGENT_MAX)
+        return -1;
+
+    *data = (char *) malloc(h.len + 1);
+    if (*data == NULL)
+        return -1;
+
+    if (agent_read(fd, *data, h.len)) {
+        free(*data);
+        *data = NULL;
+        return -1;
+    }
+
+    (*data)[h.len] = '\0';
+    *type = h.type;
+    *len = h.len;
+
+    return 0;
+}
@@ -0,0 +1,507 @@
+/*
+ * make bench: how fast webbench itself is. Microbenchmarks of its hot
+ * paths (building the request, parsing responses, UUIDs for multipart
+ * boundaries, recording and merging the statistics) and runs of each
+ * engine over loopback against webbench-null-server. Every result is
+ * the operations per second and the CPU cycles per operation, compared
+ * with those of the baseline file.
+ *
+ * webbench.c is built in whole, its main() renamed, so its functions
+ * are measured as they are compiled into webbench.
+ *
+ * Usage:
+ *   benchsuite [-w] [-t <sec>] [-p <port>] [baseline]
+ *
+ * Return codes:
+ *    0 - nothing slower than the baseline allows
+ *    1 - something is, or a run failed
+ *    2 - bad param
+ */
+#define main webbench_main
+#include "webbench.c"
+#undef main
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define BENCH_ROUNDS    5      /* of a microbenchmark, the fastest one counts */
+#define BENCH_MIN_USEC  100000 /* a round runs at least that long */
+#define BENCH_RESULTS   32
+#define BENCH_TOLERANCE 15.0   /* percent more cycles than the baseline that still pass, twice that for loopback runs */
+
+typedef struct {
+    char name[32];
+    double per_sec;
+    double cycles; /* per operation */
+    int e2e; /* a loopback run, which varies more */
+} result_t;
+
+/* params */
+const char *baseline = "bench.baseline";
+int write_baseline = 0;
+int e2e_time = 3; /* seconds of a loopback run */
+int e2e_port = 28080;
+double tolerance = BENCH_TOLERANCE;
+
+/* internal */
+result_t results[BENCH_RESULTS];
+int nresults;
+double cycles_per_sec;
+volatile unsigned long long sink; /* what the compiler must not optimize away */
+
+/* the loopback runs, webbench arguments before -t and the URL */
+static const char *e2e_runs[][8] = {
+    { "e2e_fork", "--engine", "fork", "-c", "8", NULL },
+    { "e2e_fork_keepalive", "--engine", "fork", "-c", "8", "-k", NULL },
+    { "e2e_epoll_keepalive", "--engine", "epoll", "-c", "64", "-k", NULL },
+    { "e2e_epoll_pipeline", "--engine", "epoll", "-c", "16", "--pipeline", "16", NULL },
+    { "e2e_thread_keepalive", "--engine", "thread", "-c", "64", "-k", NULL },
+    { "e2e_uring_keepalive", "--engine", "uring", "-c", "64", "-k", NULL },
+    { "e2e_uring_pipeline", "--engine", "uring", "-c", "16", "--pipeline", "16", NULL },
+};
+
+/* the time stamp counter where there is one, nsec elsewhere */
+static inline unsigned long long cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* cycles() per second, to turn the CPU time of a run into cycles */
+static void cycles_calibrate(void)
+{
+    unsigned long long start = now_usec(), c = cycles();
+    struct timespec ts = { 0, 100000000 };
+
+    nanosleep(&ts, NULL);
+    cycles_per_sec = (cycles() - c) / ((now_usec() - start) / 1e6);
+}
+
+static void result_add(const char *name, double per_sec, double cycles, int e2e)
+{
+    if (nresults == BENCH_RESULTS)
+        return;
+
+    snprintf(results[nresults].name, sizeof(results[nresults].name), "%s", name);
+    results[nresults].per_sec = per_sec;
+    results[nresults].cycles = cycles;
+    results[nresults++].e2e = e2e;
+}
+
+/*
+ * Runs fn, n operations a call, for BENCH_ROUNDS rounds of at least
+ * BENCH_MIN_USEC. The fastest round is the one least disturbed by the
+ * rest of the machine.
+ */
+static void micro(const char *name, void (*fn)(int n), int n)
+{
+    unsigned long long start, c, ops;
+    double secs, best = 0, best_cycles = 0;
+    int round;
+
+    /* caches and branch predictors warm */
+    fn(n);
+
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        ops = 0;
+        start = now_usec();
+        c = cycles();
+        do {
+            fn(n);
+            ops += n;
+        } while (now_usec() - start < BENCH_MIN_USEC);
+
+        c = cycles() - c;
+        secs = (now_usec() - start) / 1e6;
+        if (round == 0 || (double) c / ops < best_cycles) {
+            best = ops / secs;
+            best_cycles = (double) c / ops;
+        }
+    }
+
+    result_add(name, best, best_cycles, 0);
+}
+
+/* the request of a GET with keep-alive and two extra headers, as main() builds it */
+static void micro_build_request(int n)
+{
+    int i;
+    request_t req;
+
+    for (i = 0; i < n; i++) {
+        memset(&req, 0, sizeof(req));
+        req.method = METHOD_GET;
+        build_request(&req, "http://www.example.com:8080/some/path/index.html?query=1");
+        build_special_request(&req, NULL, NULL);
+        sink += req.len;
+
+        free(req.head.data);
+        free(req.piov);
+    }
+}
+
+static const char response_length[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Server: nginx/1.24.0\r\n"
+    "Date: Thu, 01 Jan 2026 00:00:00 GMT\r\n"
+    "Content-Type: text/html\r\n"
+    "Content-Length: 64\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"
+    "0123456789012345678901234567890123456789012345678901234567890123";
+
+static const char response_chunked[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Server: nginx/1.24.0\r\n"
+    "Date: Thu, 01 Jan 2026 00:00:00 GMT\r\n"
+    "Content-Type: text/html\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"
+    "10\r\n0123456789012345\r\n"
+    "10\r\n0123456789012345\r\n"
+    "20\r\n01234567890123456789012345678901\r\n"
+    "0\r\n\r\n";
+
+/* a response in one read() */
+static void micro_parse(const char *buf, size_t len, int n)
+{
+    int i;
+    http_response_t r;
+
+    for (i = 0; i < n; i++) {
+        http_response_init(&r, 0);
+        sink += http_response_parse(&r, buf, len) + r.state;
+    }
+}
+
+static void micro_parse_length(int n)
+{
+    micro_parse(response_length, sizeof(response_length) - 1, n);
+}
+
+static void micro_parse_chunked(int n)
+{
+    micro_parse(response_chunked, sizeof(response_chunked) - 1, n);
+}
+
+static void micro_uuid(int n)
+{
+    int i;
+    char uuid[UUID_SIZE + 1];
+    static uint64_t rng = 1;
+
+    for (i = 0; i < n; i++)
+        sink += random_uuid(uuid, &rng)[0];
+}
+
+/* the fields of a request with {{seq}}, {{uuid}} and {{rand:1-1000000}} */
+static void micro_fill_fields(int n)
+{
+    int i, j;
+    static char text[] = "GET /x?id=000000000000&u=00000000-0000-0000-0000-000000000000&r=0000000";
+    static uint64_t rng = 1;
+    field_t fields[3];
+
+    field_parse("{{seq}}", &fields[0]);
+    field_parse("{{uuid}}", &fields[1]);
+    field_parse("{{rand:1-1000000}}", &fields[2]);
+    fields[0].off = 10;
+    fields[1].off = 25;
+    fields[2].off = 64;
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < 3; j++)
+            field_fill(text + fields[j].off, &fields[j], i, &rng);
+        sink += text[70];
+    }
+}
+
+/* latencies as a worker records them, from 100 usec to some 100 msec */
+static void micro_histogram_record(int n)
+{
+    int i;
+    static uint64_t rng = 1;
+
+    for (i = 0; i < n; i++)
+        histogram_record(&shards[0].latency, 100 + (fast_rand(&rng) >> 47));
+}
+
+/* what the parent does with the shards of 8 workers at the end of a run */
+static void micro_stats_merge(int n)
+{
+    int i;
+    statistics_t sum;
+    histogram_t latency, handshakes[2], phases[PHASES];
+
+    for (i = 0; i < n; i++) {
+        shards_sum(&sum, 8);
+        shards_merge(&latency, handshakes, phases, 8);
+        sink += latency.total + sum.succeeded;
+    }
+}
+
+/* a program of this directory, its output into the pipe out or /dev/null if -1 */
+static pid_t spawn(const char *const argv[], int out)
+{
+    pid_t pid = fork();
+
+    if (pid != 0)
+        return pid;
+
+    if (out < 0)
+        out = open("/dev/null", O_WRONLY);
+
+    dup2(out, 1);
+    dup2(out, 2);
+    execv(argv[0], (char *const *) argv);
+    perror(argv[0]);
+    _exit(127);
+}
+
+/* webbench with args against the server, the requests per second and the cycles each took */
+static int e2e(const char *const *args)
+{
+    int pfd[2], i, status, succeeded = 0;
+    char out[8192], t[16], url[64];
+    const char *argv[16];
+    const char *p;
+    size_t len = 0;
+    ssize_t n;
+    struct rusage ru;
+    double cpu;
+    pid_t pid;
+
+    argv[0] = "./webbench";
+    for (i = 1; args[i] != NULL; i++)
+        argv[i] = args[i];
+
+    snprintf(t, sizeof(t), "%d", e2e_time);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/", e2e_port);
+    argv[i++] = "-t";
+    argv[i++] = t;
+    argv[i++] = url;
+    argv[i] = NULL;
+
+    if (pipe(pfd))
+        return 0;
+
+    pid = spawn(argv, pfd[1]);
+    close(pfd[1]);
+    while (len < sizeof(out) - 1 && (n = read(pfd[0], out + len, sizeof(out) - 1 - len)) > 0)
+        len += n;
+
+    out[len] = '\0';
+    close(pfd[0]);
+
+    /* the CPU time of webbench and of the processes it waited for */
+    if (pid < 0 || wait4(pid, &status, 0, &ru) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0
+        || (p = strstr(out, "Requests: ")) == NULL || sscanf(p, "Requests: %d", &succeeded) != 1
+        || succeeded <= 0) {
+        fprintf(stderr, "Run %s failed:\n%s", args[0], out);
+        return 0;
+    }
+
+    cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    result_add(args[0], (double) succeeded / e2e_time, cpu * cycles_per_sec / succeeded, 1);
+
+    return 1;
+}
+
+/* webbench-null-server up and taking connections, its pid; -1 if it is not */
+static pid_t e2e_server(void)
+{
+    int i, fd;
+    char listen_at[32];
+    const char *argv[] = { "./webbench-null-server", "-l", listen_at, "-s", "128", "-w", "1", NULL };
+    struct timespec ts = { 0, 50000000 };
+    struct addrinfo *ai;
+    pid_t pid;
+
+    snprintf(listen_at, sizeof(listen_at), "127.0.0.1:%d", e2e_port);
+    pid = spawn(argv, -1);
+    if (pid < 0)
+        return -1;
+
+    ai = Resolve("127.0.0.1", e2e_port);
+    for (i = 0; ai != NULL && i < 40; i++) {
+        nanosleep(&ts, NULL);
+        fd = AddrSocket(ai, 0);
+        if (fd >= 0) {
+            close(fd);
+            freeaddrinfo(ai);
+            return pid;
+        }
+    }
+
+    if (ai != NULL)
+        freeaddrinfo(ai);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+static int baseline_write(void)
+{
+    int i;
+    FILE *f = fopen(baseline, "w");
+
+    if (f == NULL) {
+        fprintf(stderr, "Error in baseline %s: %s.\n", baseline, strerror(errno));
+        return 0;
+    }
+
+    fprintf(f, "# make bench-baseline: name, operations per second, cycles per operation\n");
+    for (i = 0; i < nresults; i++)
+        fprintf(f, "%-24s %14.0f %12.1f\n", results[i].name, results[i].per_sec, results[i].cycles);
+
+    fclose(f);
+    printf("\nBaseline written to %s.\n", baseline);
+
+    return 1;
+}
+
+/* the results next to the baseline; 0 if something got slower than the tolerance */
+static int baseline_compare(void)
+{
+    int i, rc = 1, found, slower;
+    char line[256], name[64];
+    double per_sec, cycles, change;
+    FILE *f = fopen(baseline, "r");
+
+    if (f == NULL) {
+        fprintf(stderr, "No baseline %s to compare with, make bench-baseline writes one.\n", baseline);
+        return 1;
+    }
+
+    printf("\n%-24s %14s %12s %12s %8s\n", "", "per sec", "cycles/op", "baseline", "change");
+    for (i = 0; i < nresults; i++) {
+        rewind(f);
+        found = 0;
+        while (!found && fgets(line, sizeof(line), f)) {
+            found = line[0] != '#' && sscanf(line, "%63s %lf %lf", name, &per_sec, &cycles) == 3
+                && strcmp(name, results[i].name) == 0;
+        }
+
+        if (!found) {
+            printf("%-24s %14.0f %12.1f %12s\n", results[i].name, results[i].per_sec, results[i].cycles, "-");
+            continue;
+        }
+
+        change = 100.0 * (results[i].cycles - cycles) / cycles;
+        slower = change > (results[i].e2e ? 2 * tolerance : tolerance);
+        printf("%-24s %14.0f %12.1f %12.1f %+7.1f%%%s\n", results[i].name, results[i].per_sec,
+            results[i].cycles, cycles, change, slower ? "  slower" : "");
+        if (slower)
+            rc = 0;
+    }
+
+    fclose(f);
+    if (!rc)
+        printf("\nSlower than %s by more than %.0f%% of its cycles, %.0f%% for loopback runs.\n", baseline,
+            tolerance, 2 * tolerance);
+
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, i, rc = 0;
+    const char *env = getenv("BENCH_TOLERANCE");
+    pid_t server;
+
+    while ((opt = getopt(argc, argv, "wt:p:")) != EOF) {
+        switch (opt) {
+        case 'w':
+            write_baseline = 1;
+            break;
+        case 't':
+            e2e_time = atoi(optarg);
+            if (e2e_time <= 0) {
+                fprintf(stderr, "Error in option -t %s: Must be greater than 0.\n", optarg);
+                return 2;
+            }
+
+            break;
+        case 'p':
+            e2e_port = atoi(optarg);
+            if (e2e_port <= 0) {
+                fprintf(stderr, "Error in option -p %s: Bad port.\n", optarg);
+                return 2;
+            }
+
+            break;
+        default:
+            fprintf(stderr, "benchsuite [-w] [-t <sec>] [-p <port>] [baseline]\n");
+            return 2;
+        }
+    }
+
+    if (optind < argc)
+        baseline = argv[optind];
+
+    if (env != NULL)
+        tolerance = atof(env);
+
+    cycles_calibrate();
+    signal(SIGPIPE, SIG_IGN);
+
+    /* what main() of webbench sets up for the hot paths */
+    bench_params.http_version = 2;
+    bench_params.keepalive = 1;
+    init_header(2);
+    bench_params.header.key[0] = "Accept";
+    bench_params.header.value[0] = "*/*";
+    bench_params.header.key[1] = "Accept-Encoding";
+    bench_params.header.value[1] = "gzip, deflate";
+
+    shards = (shard_t *)calloc(8, sizeof(shard_t));
+    if (shards == NULL) {
+        fprintf(stderr, "Error in alloc for shards.\n");
+        return 1;
+    }
+
+    for (i = 0; i < 8; i++)
+        worker_place(i);
+
+    printf("Microbenchmarks, %.0f cycles per sec ...\n", cycles_per_sec);
+    fflush(stdout);
+    micro("build_request", micro_build_request, 1000);
+    micro("parse_content_length", micro_parse_length, 10000);
+    micro("parse_chunked", micro_parse_chunked, 10000);
+    micro("uuid", micro_uuid, 1000);
+    micro("fill_fields", micro_fill_fields, 1000);
+    micro("histogram_record", micro_histogram_record, 100000);
+    micro("stats_merge", micro_stats_merge, 10);
+
+    printf("Loopback runs against webbench-null-server on port %d, %d sec each ...\n", e2e_port, e2e_time);
+    fflush(stdout);
+    server = e2e_server();
+    if (server < 0) {
+        fprintf(stderr, "webbench-null-server did not start, no loopback runs.\n");
+        rc = 1;
+    }
+
+    for (i = 0; server >= 0 && i < (int) (sizeof(e2e_runs) / sizeof(e2e_runs[0])); i++) {
+        if (!e2e(e2e_runs[i]))
+            rc = 1;
+    }
+
+    if (server >= 0) {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+    }
+
+    if (write_baseline)
+        return baseline_write() ? rc : 1;
+
+    return baseline_compare() ? rc : 1;
+}
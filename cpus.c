@@ -0,0 +1,61 @@
+/*
+ * CPU lists as taskset -c takes them and /sys shows them: 0-3,8,10-11.
+ */
+
+#include <sched.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+/* parses list into set, returns 0 if it is malformed */
+int cpus_parse(const char *list, cpu_set_t *set)
+{
+    char *end;
+    long first, last;
+
+    CPU_ZERO(set);
+
+    for ( ;; ) {
+        if (!isdigit((unsigned char) *list))
+            return 0;
+
+        first = last = strtol(list, &end, 10);
+        if (*end == '-') {
+            list = end + 1;
+            if (!isdigit((unsigned char) *list))
+                return 0;
+
+            last = strtol(list, &end, 10);
+        }
+
+        if (last < first || last >= CPU_SETSIZE)
+            return 0;
+
+        for ( ; first <= last; first++)
+            CPU_SET(first, set);
+
+        if (*end == '\0')
+            return 1;
+
+        if (*end != ',')
+            return 0;
+
+        list = end + 1;
+    }
+}
+
+/* the nth CPU of set, starting over past the last one; -1 if it is empty */
+int cpus_nth(const cpu_set_t *set, int n)
+{
+    int i, count = CPU_COUNT(set);
+
+    if (count == 0)
+        return -1;
+
+    n %= count;
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, set) && n-- == 0)
+            return i;
+    }
+
+    return -1;
+}
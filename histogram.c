@@ -0,0 +1,116 @@
+/*
+ * Fixed size log-linear (HDR style) histogram.
+ *
+ * Values below HIST_SUB_COUNT are counted exactly, larger ones in
+ * HIST_SUB_COUNT / 2 linear buckets per power of two, which keeps the
+ * relative error under 1/64. Recording is a few shifts and an add, and
+ * histograms of different workers merge by adding their counts.
+ */
+
+#include <string.h>
+
+#define HIST_SUB_BITS  7
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_SUB_HALF  (HIST_SUB_COUNT / 2)
+#define HIST_MAX_BITS  32 /* larger values are clamped */
+#define HIST_SIZE      (HIST_SUB_COUNT + (HIST_MAX_BITS - HIST_SUB_BITS) * HIST_SUB_HALF)
+
+typedef struct {
+    unsigned long long total;
+    unsigned long long min;
+    unsigned long long max;
+    unsigned long long sum;
+    unsigned long long counts[HIST_SIZE];
+} histogram_t;
+
+/* all zero is empty, as fresh anonymous memory already is: min counts from the first value */
+void histogram_init(histogram_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+static int histogram_index(unsigned long long v)
+{
+    int shift;
+
+    if (v < HIST_SUB_COUNT)
+        return (int) v;
+
+    if (v >> HIST_MAX_BITS)
+        v = (1ULL << HIST_MAX_BITS) - 1;
+
+    /* shift so that v lands in [HIST_SUB_HALF, HIST_SUB_COUNT) */
+    shift = 63 - __builtin_clzll(v) - (HIST_SUB_BITS - 1);
+
+    return HIST_SUB_COUNT + (shift - 1) * HIST_SUB_HALF + (int) (v >> shift) - HIST_SUB_HALF;
+}
+
+/* highest value counted in bucket i */
+static unsigned long long histogram_value(int i)
+{
+    int shift;
+
+    if (i < HIST_SUB_COUNT)
+        return i;
+
+    shift = (i - HIST_SUB_COUNT) / HIST_SUB_HALF + 1;
+
+    return ((unsigned long long) ((i - HIST_SUB_COUNT) % HIST_SUB_HALF + HIST_SUB_HALF + 1) << shift) - 1;
+}
+
+void histogram_record(histogram_t *h, unsigned long long v)
+{
+    h->counts[histogram_index(v)]++;
+    h->sum += v;
+
+    if (h->total++ == 0 || v < h->min)
+        h->min = v;
+
+    if (v > h->max)
+        h->max = v;
+}
+
+void histogram_merge(histogram_t *dst, const histogram_t *src)
+{
+    int i;
+
+    if (src->total == 0)
+        return;
+
+    for (i = 0; i < HIST_SIZE; i++)
+        dst->counts[i] += src->counts[i];
+
+    if (dst->total == 0 || src->min < dst->min)
+        dst->min = src->min;
+
+    dst->total += src->total;
+    dst->sum += src->sum;
+
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/* value at or below which percentile p (0 - 100) of the recorded values are */
+unsigned long long histogram_percentile(const histogram_t *h, double p)
+{
+    int i;
+    unsigned long long seen = 0, rank;
+    unsigned long long v;
+
+    if (h->total == 0)
+        return 0;
+
+    rank = (unsigned long long) (p / 100.0 * h->total + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    for (i = 0; i < HIST_SIZE; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            v = histogram_value(i);
+            return v > h->max ? h->max : v;
+        }
+    }
+
+    return h->max;
+}
@@ -0,0 +1,244 @@
+/*
+ * Incremental HTTP/1.x response parser.
+ *
+ * Only finds where a response ends (status line, headers, and a body
+ * framed by Content-Length, chunked encoding or the end of connection)
+ * and whether the connection may be reused. It works on the chunks as
+ * they come out of read() and never allocates or copies the body.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <sys/types.h>
+
+#define HTTP_LINE_SIZE 128
+
+/* parser states */
+#define HTTP_STATUS_LINE 0
+#define HTTP_HEADER_LINE 1
+#define HTTP_BODY        2 /* Content-Length bytes left */
+#define HTTP_BODY_EOF    3 /* body ends when the server closes */
+#define HTTP_CHUNK_SIZE  4
+#define HTTP_CHUNK_DATA  5
+#define HTTP_CHUNK_CRLF  6
+#define HTTP_TRAILER     7
+#define HTTP_DONE        8
+#define HTTP_ERROR       9
+
+typedef struct {
+    int state;
+    int head;       /* response to a HEAD request, never has a body */
+    int status;
+    int keepalive;  /* connection may be reused after this response */
+    int chunked;
+    long long content_length; /* -1 if not given */
+    long long remaining;      /* body or chunk bytes left */
+    size_t received;          /* bytes fed so far */
+    size_t line_len;
+    char line[HTTP_LINE_SIZE];
+} http_response_t;
+
+void http_response_init(http_response_t *r, int head)
+{
+    r->state = HTTP_STATUS_LINE;
+    r->head = head;
+    r->status = 0;
+    r->keepalive = 0;
+    r->chunked = 0;
+    r->content_length = -1;
+    r->remaining = 0;
+    r->received = 0;
+    r->line_len = 0;
+}
+
+/* 1 for 1xx up to 5 for 5xx, 0 if no valid status line was seen */
+int http_status_class(const http_response_t *r)
+{
+    int c = r->status / 100;
+
+    return c >= 1 && c <= 5 ? c : 0;
+}
+
+static int http_header_is(const char *line, const char *name, const char **value)
+{
+    size_t n = strlen(name);
+
+    if (strncasecmp(line, name, n) != 0 || line[n] != ':')
+        return 0;
+
+    for (line += n + 1; *line == ' ' || *line == '\t'; line++) { /* void */ }
+
+    *value = line;
+    return 1;
+}
+
+static int http_status_line(http_response_t *r)
+{
+    const char *p = r->line;
+
+    /* HTTP/1.x nnn reason */
+    if (strncmp(p, "HTTP/1.", 7) != 0 || !isdigit((unsigned char) p[7]) || p[8] != ' ')
+        return -1;
+
+    /* HTTP/1.1 is persistent by default, HTTP/1.0 is not */
+    r->keepalive = p[7] != '0';
+
+    p += 9;
+    if (!isdigit((unsigned char) p[0]) || !isdigit((unsigned char) p[1]) || !isdigit((unsigned char) p[2]))
+        return -1;
+
+    r->status = (p[0] - '0') * 100 + (p[1] - '0') * 10 + (p[2] - '0');
+    r->state = HTTP_HEADER_LINE;
+    return 0;
+}
+
+static int http_header_line(http_response_t *r)
+{
+    const char *value;
+
+    if (r->line_len > 0) {
+        if (http_header_is(r->line, "Content-Length", &value)) {
+            if (!isdigit((unsigned char) *value))
+                return -1;
+
+            r->content_length = strtoll(value, NULL, 10);
+        } else if (http_header_is(r->line, "Transfer-Encoding", &value)) {
+            /* chunked must be the last coding */
+            for ( ; *value; value++) {
+                if (strncasecmp(value, "chunked", 7) == 0)
+                    r->chunked = 1;
+            }
+        } else if (http_header_is(r->line, "Connection", &value)) {
+            for ( ; *value; value++) {
+                if (strncasecmp(value, "close", 5) == 0)
+                    r->keepalive = 0;
+                else if (strncasecmp(value, "keep-alive", 10) == 0)
+                    r->keepalive = 1;
+            }
+        }
+
+        return 0;
+    }
+
+    /* empty line: end of headers */
+    if (r->status / 100 == 1 && r->status != 101) {
+        /* interim response, the real one follows */
+        http_response_init(r, r->head);
+        return 0;
+    }
+
+    if (r->head || r->status == 204 || r->status == 304) {
+        r->state = HTTP_DONE;
+    } else if (r->chunked) {
+        r->state = HTTP_CHUNK_SIZE;
+    } else if (r->content_length >= 0) {
+        r->remaining = r->content_length;
+        r->state = r->remaining ? HTTP_BODY : HTTP_DONE;
+    } else {
+        r->keepalive = 0;
+        r->state = HTTP_BODY_EOF;
+    }
+
+    return 0;
+}
+
+static int http_chunk_size_line(http_response_t *r)
+{
+    char *end;
+
+    r->remaining = strtoll(r->line, &end, 16);
+    if (end == r->line || r->remaining < 0)
+        return -1;
+
+    r->state = r->remaining ? HTTP_CHUNK_DATA : HTTP_TRAILER;
+    return 0;
+}
+
+/*
+ * Feed len bytes of the response. Returns the number of bytes that
+ * belong to this response, so whatever follows HTTP_DONE is the start
+ * of the next one, or -1 on a malformed response.
+ */
+ssize_t http_response_parse(http_response_t *r, const char *buf, size_t len)
+{
+    const char *p = buf, *end = buf + len, *nl;
+    size_t n;
+    int rc;
+
+    while (p < end) {
+        switch (r->state) {
+        case HTTP_BODY:
+        case HTTP_CHUNK_DATA:
+            n = end - p;
+            if ((long long) n > r->remaining)
+                n = r->remaining;
+
+            p += n;
+            r->remaining -= n;
+            if (r->remaining == 0)
+                r->state = r->state == HTTP_BODY ? HTTP_DONE : HTTP_CHUNK_CRLF;
+
+            break;
+        case HTTP_BODY_EOF:
+            p = end;
+            break;
+        case HTTP_DONE:
+            r->received += p - buf;
+            return p - buf;
+        case HTTP_ERROR:
+            return -1;
+        default:
+            /* line based states: collect up to '\n' */
+            nl = memchr(p, '\n', end - p);
+            n = (nl ? nl : end) - p;
+            if (r->line_len + n >= HTTP_LINE_SIZE)
+                n = HTTP_LINE_SIZE - 1 - r->line_len; /* long lines are cut */
+
+            memcpy(r->line + r->line_len, p, n);
+            r->line_len += n;
+
+            if (nl == NULL) {
+                p = end;
+                break;
+            }
+
+            p = nl + 1;
+            if (r->line_len > 0 && r->line[r->line_len - 1] == '\r')
+                r->line_len--;
+
+            r->line[r->line_len] = '\0';
+
+            switch (r->state) {
+            case HTTP_STATUS_LINE:
+                rc = http_status_line(r);
+                break;
+            case HTTP_HEADER_LINE:
+                rc = http_header_line(r);
+                break;
+            case HTTP_CHUNK_SIZE:
+                rc = http_chunk_size_line(r);
+                break;
+            case HTTP_CHUNK_CRLF:
+                rc = r->line_len ? -1 : 0;
+                r->state = HTTP_CHUNK_SIZE;
+                break;
+            case HTTP_TRAILER:
+            default:
+                rc = 0;
+                if (r->line_len == 0)
+                    r->state = HTTP_DONE;
+            }
+
+            r->line_len = 0;
+            if (rc < 0) {
+                r->state = HTTP_ERROR;
+                return -1;
+            }
+        }
+    }
+
+    r->received += p - buf;
+    return p - buf;
+}
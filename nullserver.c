@@ -0,0 +1,568 @@
+/*
+ * webbench-null-server: an HTTP server that does nothing but answer, at
+ * once, with a response of a given size. Run on the same machine as
+ * webbench it is the reference to compare a result with: what webbench
+ * itself reaches with an engine and its options, when no real server
+ * work is in the way.
+ *
+ * Every worker thread runs its own epoll loop over the connections it
+ * accepted. Requests are HTTP/0.9 to 1.1, pipelined or not, kept alive
+ * as HTTP/1.1 and Connection: keep-alive have it. Request bodies of a
+ * Content-Length, as -o and multipart uploads with -i send, are read
+ * and thrown away before the response. The responses are built once at
+ * startup and written from there for every request.
+ *
+ * Usage:
+ *   webbench-null-server --help
+ */
+#define _GNU_SOURCE /* accept4(), memmem() */
+#include "socket.c"
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+
+#define PROGRAM_VERSION "1.6"
+
+#define IN_SIZE    8192 /* the longest request head taken */
+#define FLUSH_IOVS 64   /* pipelined responses written with one writev() */
+#define EVENTS     256
+
+/* the responses, built at startup */
+#define RESP_KEEPALIVE 0
+#define RESP_CLOSE     1
+#define RESP_HEAD      2 /* the same without the body, + RESP_KEEPALIVE or RESP_CLOSE */
+#define RESP_HTTP09    4 /* the body only, then close */
+#define RESPONSES      5
+
+typedef struct {
+    char *data;
+    size_t len;
+} response_t;
+
+typedef struct {
+    int fd;
+    uint32_t events; /* epoll events waited for */
+    size_t body; /* bytes of the request body still to skip */
+    const response_t *after; /* queued once the body is skipped */
+    const response_t *out; /* being written */
+    int queued; /* of out, the first written from off */
+    size_t off;
+    int closing; /* after the queued responses */
+    size_t len; /* read into in */
+    char in[IN_SIZE];
+} conn_t;
+
+/* params */
+const char *listen_at = "127.0.0.1:8080";
+long size = 0; /* of the response body */
+long chunked = 0; /* body in chunks of this size, 0 for Content-Length */
+int workers = 0;
+
+/* internal */
+response_t responses[RESPONSES];
+int listen_fd;
+
+static const struct option long_options[] =
+{
+    {"listen",   required_argument,  NULL,  'l'},
+    {"size",     required_argument,  NULL,  's'},
+    {"chunked",  required_argument,  NULL,  'C'},
+    {"workers",  required_argument,  NULL,  'w'},
+    {"help",     no_argument,        NULL,  '?'},
+    {"version",  no_argument,        NULL,  'V'},
+    {NULL,       0,                  NULL,   0}
+};
+
+static void usage(void)
+{
+   fprintf(stderr,
+    "webbench-null-server [option]...\n"
+    "  -l|--listen [host]:port  Address to take connections on.\n"
+    "                           Default 127.0.0.1:8080.\n"
+    "  -s|--size <bytes>        Answer every request with a body of <bytes>.\n"
+    "                           Default 0.\n"
+    "  -C|--chunked <bytes>     Send the body chunked, in chunks of <bytes>.\n"
+    "  -w|--workers <n>         Threads, each with an epoll loop. Default CPUs.\n"
+    "  -?|-h|--help             This information.\n"
+    "  -V|--version             Display program version.\n"
+    );
+}
+
+static void response_append(response_t *r, const void *data, size_t len)
+{
+    memcpy(r->data + r->len, data, len);
+    r->len += len;
+}
+
+/* status line and headers of a kept alive or closed response, with the body unless head */
+static int response_build(response_t *r, int closes, int head)
+{
+    char line[256];
+    long n, left;
+    int len;
+
+    /* the headers, a chunk header and CRLF per chunk and the last chunk at most */
+    r->data = (char *)malloc(256 + size + (chunked ? (size / chunked + 2) * 24 : 0));
+    if (r->data == NULL)
+        return 0;
+
+    r->len = 0;
+    if (chunked)
+        len = snprintf(line, sizeof(line), "Transfer-Encoding: chunked\r\n");
+    else
+        len = snprintf(line, sizeof(line), "Content-Length: %ld\r\n", size);
+
+    response_append(r, "HTTP/1.1 200 OK\r\n", 17);
+    response_append(r, "Server: webbench-null-server\r\n", 30);
+    response_append(r, "Content-Type: text/plain\r\n", 26);
+    response_append(r, line, len);
+    if (closes)
+        response_append(r, "Connection: close\r\n\r\n", 21);
+    else
+        response_append(r, "Connection: keep-alive\r\n\r\n", 26);
+
+    if (head)
+        return 1;
+
+    for (left = size; left > 0 || (chunked && left == 0); left -= n) {
+        n = chunked && chunked < left ? chunked : left;
+        if (chunked) {
+            len = snprintf(line, sizeof(line), "%lx\r\n", n);
+            response_append(r, line, len);
+        }
+
+        memset(r->data + r->len, 'x', n);
+        r->len += n;
+        if (chunked) {
+            response_append(r, "\r\n", 2);
+            if (n == 0)
+                break;
+        }
+    }
+
+    return 1;
+}
+
+static int responses_build(void)
+{
+    response_t *r = &responses[RESP_HTTP09];
+
+    if (!response_build(&responses[RESP_KEEPALIVE], 0, 0) || !response_build(&responses[RESP_CLOSE], 1, 0)
+        || !response_build(&responses[RESP_HEAD + RESP_KEEPALIVE], 0, 1)
+        || !response_build(&responses[RESP_HEAD + RESP_CLOSE], 1, 1))
+        return 0;
+
+    /* no status line or headers, a body as it is */
+    r->data = (char *)malloc(size + 1);
+    if (r->data == NULL)
+        return 0;
+
+    memset(r->data, 'x', size);
+    r->len = size;
+
+    return 1;
+}
+
+/* value of the header name: in the head that ends at end, NULL if it is not there */
+static const char *header_find(const char *head, const char *end, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p;
+
+    for (p = head; p < end; p++) {
+        p = memchr(p, '\n', end - p);
+        if (p == NULL)
+            return NULL;
+
+        if ((size_t) (end - p) > len && strncasecmp(p + 1, name, len) == 0 && p[len + 1] == ':') {
+            for (p += len + 2; *p == ' ' || *p == '\t'; p++) { /* void */ }
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Takes the next request head out of c->in, if it is all there, and
+ * sets what its response is. Returns its length, 0 if more is needed, -1
+ * if the request is not one we take.
+ */
+static ssize_t request_parse(conn_t *c)
+{
+    const char *p, *end, *line;
+    int closes, http10, n;
+
+    line = memchr(c->in, '\n', c->len);
+    if (line == NULL)
+        return c->len == IN_SIZE ? -1 : 0;
+
+    /* HTTP/0.9: the request line alone */
+    p = memmem(c->in, line - c->in, " HTTP/1.", 8);
+    if (p == NULL) {
+        c->after = &responses[RESP_HTTP09];
+        c->closing = 1;
+        return line + 1 - c->in;
+    }
+
+    http10 = p[8] == '0';
+    end = memmem(c->in, c->len, "\r\n\r\n", 4);
+    if (end == NULL)
+        return c->len == IN_SIZE ? -1 : 0;
+
+    end += 4;
+
+    /* HTTP/1.1 stays open unless asked to close, 1.0 only if asked to stay */
+    p = header_find(c->in, end, "Connection");
+    if (p != NULL && strncasecmp(p, "close", 5) == 0)
+        closes = 1;
+    else if (p != NULL && strncasecmp(p, "keep-alive", 10) == 0)
+        closes = 0;
+    else
+        closes = http10;
+
+    /* a chunked body would have to be parsed, it is answered and the connection closed */
+    p = header_find(c->in, end, "Transfer-Encoding");
+    if (p != NULL && strncasecmp(p, "identity", 8) != 0)
+        closes = 1;
+
+    p = header_find(c->in, end, "Content-Length");
+    c->body = p != NULL ? strtoul(p, NULL, 10) : 0;
+
+    n = c->len >= 5 && strncmp(c->in, "HEAD ", 5) == 0 ? RESP_HEAD : 0;
+    c->after = &responses[n + (closes ? RESP_CLOSE : RESP_KEEPALIVE)];
+    c->closing = closes;
+
+    return end - c->in;
+}
+
+/* change the events the connection waits for */
+static int conn_want(int epfd, conn_t *c, uint32_t events)
+{
+    struct epoll_event ev;
+
+    if (c->events == events)
+        return 0;
+
+    ev.events = events;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev))
+        return -1;
+
+    c->events = events;
+    return 0;
+}
+
+/*
+ * Parse what was read, skipping bodies and queueing responses. Stops at
+ * a response other than the queued ones, until those are written, and
+ * at one that closes. Returns -1 on a bad request.
+ */
+static int conn_input(conn_t *c)
+{
+    size_t used = 0, n;
+    ssize_t head;
+
+    while (used < c->len || (c->after && c->body == 0)) {
+        if (c->after == NULL) {
+            if (c->closing)
+                break;
+
+            /* the next request starts at the beginning of in */
+            if (used) {
+                memmove(c->in, c->in + used, c->len - used);
+                c->len -= used;
+                used = 0;
+            }
+
+            head = request_parse(c);
+            if (head < 0)
+                return -1;
+
+            if (head == 0)
+                break;
+
+            used = head;
+            continue;
+        }
+
+        n = c->len - used < c->body ? c->len - used : c->body;
+        used += n;
+        c->body -= n;
+        if (c->body)
+            break;
+
+        if (c->queued && c->out != c->after)
+            break;
+
+        c->out = c->after;
+        c->queued++;
+        c->after = NULL;
+    }
+
+    memmove(c->in, c->in + used, c->len - used);
+    c->len -= used;
+
+    return 0;
+}
+
+/* write the queued responses; 1 when all are out, 0 if it would block, -1 on error */
+static int conn_flush(conn_t *c)
+{
+    struct iovec iov[FLUSH_IOVS];
+    const response_t *r = c->out;
+    ssize_t n;
+    int i;
+
+    while (c->queued) {
+        iov[0].iov_base = r->data + c->off;
+        iov[0].iov_len = r->len - c->off;
+        for (i = 1; i < c->queued && i < FLUSH_IOVS; i++) {
+            iov[i].iov_base = r->data;
+            iov[i].iov_len = r->len;
+        }
+
+        n = writev(c->fd, iov, i);
+        if (n < 0)
+            return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+        for (c->off += n; c->queued && c->off >= r->len; c->queued--)
+            c->off -= r->len;
+    }
+
+    c->off = 0;
+    return 1;
+}
+
+static void conn_free(conn_t *c)
+{
+    close(c->fd);
+    free(c);
+}
+
+/* read, answer and read again for as long as the connection has something */
+static void conn_serve(int epfd, conn_t *c)
+{
+    ssize_t n;
+
+    for ( ;; ) {
+        switch (conn_flush(c)) {
+        case 0:
+            if (conn_want(epfd, c, EPOLLOUT))
+                conn_free(c);
+
+            return;
+        case -1:
+            conn_free(c);
+            return;
+        }
+
+        /* everything queued is out: parse what is left, then read more */
+        if (conn_input(c)) {
+            conn_free(c);
+            return;
+        }
+
+        if (c->queued)
+            continue;
+
+        if (c->closing && c->after == NULL) {
+            conn_free(c);
+            return;
+        }
+
+        n = read(c->fd, c->in + c->len, IN_SIZE - c->len);
+        if (n > 0) {
+            c->len += n;
+            if (conn_input(c)) {
+                conn_free(c);
+                return;
+            }
+
+            continue;
+        }
+
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            conn_free(c);
+            return;
+        }
+
+        if (conn_want(epfd, c, EPOLLIN))
+            conn_free(c);
+
+        return;
+    }
+}
+
+/* takes the connections waiting on the listening socket */
+static void conn_accept(int epfd)
+{
+    int fd;
+    conn_t *c;
+    struct epoll_event ev;
+
+    for ( ;; ) {
+        fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+                perror("accept failed.");
+
+            return;
+        }
+
+        c = (conn_t *)calloc(1, sizeof(conn_t));
+        if (c == NULL) {
+            close(fd);
+            continue;
+        }
+
+        c->fd = fd;
+        c->events = EPOLLIN;
+        ev.events = c->events;
+        ev.data.ptr = c;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+            conn_free(c);
+    }
+}
+
+static void *worker(void *arg)
+{
+    int i, n, epfd;
+    struct epoll_event ev, events[EVENTS];
+    conn_t *c;
+
+    (void) arg;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;
+    if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev)) {
+        perror("epoll setup failed.");
+        exit(3);
+    }
+
+    for ( ;; ) {
+        n = epoll_wait(epfd, events, EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            perror("epoll_wait failed.");
+            exit(3);
+        }
+
+        for (i = 0; i < n; i++) {
+            c = (conn_t *)events[i].data.ptr;
+            if (c == NULL)
+                conn_accept(epfd);
+            else
+                conn_serve(epfd, c);
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, i, port;
+    char *at, *host;
+    pthread_t tid;
+    struct rlimit rl;
+
+    while ((opt = getopt_long(argc, argv, "l:s:C:w:V?h", long_options, NULL)) != EOF) {
+        switch (opt) {
+        case 'l':
+            listen_at = optarg;
+            break;
+        case 's':
+            size = atol(optarg);
+            if (size < 0) {
+                fprintf(stderr, "Error in option --size %s: Must not be negative.\n", optarg);
+                return 2;
+            }
+
+            break;
+        case 'C':
+            chunked = atol(optarg);
+            if (chunked <= 0) {
+                fprintf(stderr, "Error in option --chunked %s: Must be greater than 0.\n", optarg);
+                return 2;
+            }
+
+            break;
+        case 'w':
+            workers = atoi(optarg);
+            if (workers <= 0) {
+                fprintf(stderr, "Error in option --workers %s: Must be greater than 0.\n", optarg);
+                return 2;
+            }
+
+            break;
+        case 'V':
+            printf(PROGRAM_VERSION "\n");
+            return 0;
+        default:
+            usage();
+            return 2;
+        }
+    }
+
+    if (optind < argc) {
+        usage();
+        return 2;
+    }
+
+    /* [host]:port, host:port or :port for any address */
+    at = strdup(listen_at);
+    port = at ? HostPort(at, &host) : -1;
+    if (port < 0) {
+        fprintf(stderr, "Error in option --listen %s: Bad [host]:port.\n", listen_at);
+        free(at);
+        return 2;
+    }
+
+    if (!responses_build()) {
+        fprintf(stderr, "Error in alloc for responses.\n");
+        return 3;
+    }
+
+    listen_fd = ListenSocket(host, port, SOMAXCONN);
+    free(at);
+    if (listen_fd < 0 || fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL, 0) | O_NONBLOCK) < 0) {
+        fprintf(stderr, "Error in option --listen %s: Can not listen.\n", listen_at);
+        return 1;
+    }
+
+    /* as many connections as the system lets us have */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (workers == 0)
+        workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (workers <= 0)
+        workers = 1;
+
+    for (i = 1; i < workers; i++) {
+        if (pthread_create(&tid, NULL, worker, NULL)) {
+            fprintf(stderr, "problems starting worker no. %d\n", i);
+            return 3;
+        }
+    }
+
+    printf("Answering on %s with %ld bytes%s, %d workers.\n", listen_at, size, chunked ? " chunked" : "", workers);
+    fflush(stdout);
+
+    worker(NULL);
+
+    return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * --ramp schedules: stages of clients or of a request rate, one after
+ * the other, as 100:30s,500:30s,1000:1m. A stage holds its value, or
+ * with two of them (0-500:1m) goes from the first to the second
+ * linearly. Rates are written as 1000/s, all stages alike.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    double from; /* clients or requests/sec at the start */
+    double to;   /* at the end, the same for a step */
+    unsigned long long start; /* usec into the run */
+    unsigned long long end;
+} stage_t;
+
+/* a value of a stage, up to where it ends */
+static int ramp_number(const char **p, double *v)
+{
+    char *end;
+
+    *v = strtod(*p, &end);
+    if (end == *p || !(*v >= 0 && *v < 1e9))
+        return 0;
+
+    *p = end;
+    return 1;
+}
+
+/*
+ * Parses list into *stages, returns their number or 0 if it is
+ * malformed. *rate tells whether the values are requests per second.
+ */
+int ramp_parse(const char *list, stage_t **stages, int *rate)
+{
+    int i, n = 1, r;
+    long secs;
+    const char *p;
+    char *end;
+    stage_t *s;
+
+    for (p = list; *p; p++)
+        n += *p == ',';
+
+    s = (stage_t *)calloc(n, sizeof(stage_t));
+    if (s == NULL)
+        return 0;
+
+    *rate = -1;
+    for (i = 0, p = list; i < n; i++, p = end + 1) {
+        if (!ramp_number(&p, &s[i].from))
+            goto bad;
+
+        s[i].to = s[i].from;
+        if (*p == '-') {
+            p++;
+            if (!ramp_number(&p, &s[i].to))
+                goto bad;
+        }
+
+        r = strncmp(p, "/s", 2) == 0;
+        if (r)
+            p += 2;
+
+        if (*p != ':' || (*rate >= 0 && r != *rate))
+            goto bad;
+
+        *rate = r;
+        secs = strtol(++p, &end, 10);
+        if (end == p || secs <= 0 || secs > 86400)
+            goto bad;
+
+        if (*end == 'm') {
+            secs *= 60;
+            end++;
+        } else if (*end == 's')
+            end++;
+
+        s[i].start = i ? s[i - 1].end : 0;
+        s[i].end = s[i].start + secs * 1000000ULL;
+        if (*end != (i == n - 1 ? '\0' : ','))
+            goto bad;
+    }
+
+    *stages = s;
+    return n;
+
+bad:
+    free(s);
+    return 0;
+}
+
+/* the stage at usec into the run, the last one past its end */
+int ramp_stage(const stage_t *s, int n, unsigned long long usec)
+{
+    int i;
+
+    for (i = 0; i < n - 1 && usec >= s[i].end; i++) { /* void */ }
+
+    return i;
+}
+
+/*
+ * The value of the schedule of a run that began at start, at now. It
+ * holds until *until: the end of a step, or in a linear stage the moment
+ * it rounds to the next whole number.
+ */
+double ramp_value(const stage_t *s, int n, unsigned long long start, unsigned long long now,
+    unsigned long long *until)
+{
+    unsigned long long usec = now > start ? now - start : 0, at;
+    double v, next;
+
+    s += ramp_stage(s, n, usec);
+    if (usec >= s->end) {
+        *until = ~0ULL;
+        return s->to;
+    }
+
+    *until = start + s->end;
+    if (s->to == s->from)
+        return s->from;
+
+    v = s->from + (s->to - s->from) * (usec - s->start) / (s->end - s->start);
+    next = (long long) (v + 0.5) + (s->to > s->from ? 0.5 : -0.5);
+    at = start + s->start + (unsigned long long) ((next - s->from) / (s->to - s->from) * (s->end - s->start)) + 1;
+
+    /* not more often than every msec */
+    if (at < now + 1000)
+        at = now + 1000;
+
+    if (at < *until)
+        *until = at;
+
+    return v;
+}
+
+/* the most clients or the highest rate of the schedule */
+double ramp_max(const stage_t *s, int n)
+{
+    int i;
+    double max = 0;
+
+    for (i = 0; i < n; i++) {
+        if (s[i].from > max)
+            max = s[i].from;
+
+        if (s[i].to > max)
+            max = s[i].to;
+    }
+
+    return max;
+}
+
+/* stage s for the reports: 30-90s, 0-500 clients */
+void ramp_name(char *buf, size_t size, const stage_t *s, int rate)
+{
+    int n = snprintf(buf, size, "%llu-%llus, %g", s->start / 1000000, s->end / 1000000, s->from);
+
+    if (s->to != s->from && n > 0 && (size_t) n < size)
+        n += snprintf(buf + n, size - n, "-%g", s->to);
+
+    if (n > 0 && (size_t) n < size)
+        snprintf(buf + n, size - n, rate ? " requests/sec" : s->to == 1 && s->from == 1 ? " client" : " clients");
+}
@@ -0,0 +1,142 @@
+/*
+ * Scenario files: a weighted mix of requests, one per line.
+ *
+ * Lines are split into whitespace separated words, "double quotes"
+ * keep a word together, # starts a comment. Which entry a client sends
+ * next is drawn with the alias method (Walker/Vose), one random number
+ * and one table lookup whatever the number of entries.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SCENARIO_MAX_WORDS 64
+
+typedef struct {
+    int n;
+    uint64_t *prob; /* keep entry i if the low 32 random bits are below */
+    int *alias;     /* else take this one */
+} alias_t;
+
+/* splits line in place, returns the number of words or -1 if too many */
+int scenario_split(char *line, char *word[SCENARIO_MAX_WORDS])
+{
+    int n = 0;
+    char *p = line, *q;
+
+    for ( ;; ) {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+            p++;
+
+        if (*p == '\0' || *p == '#')
+            return n;
+
+        if (n == SCENARIO_MAX_WORDS)
+            return -1;
+
+        if (*p == '"') {
+            word[n++] = ++p;
+            q = strchr(p, '"');
+            if (q == NULL)
+                return n;
+
+            *q = '\0';
+            p = q + 1;
+            continue;
+        }
+
+        word[n++] = p;
+        p += strcspn(p, " \t\r\n");
+        if (*p == '\0')
+            return n;
+
+        *p++ = '\0';
+    }
+}
+
+/* builds the table for n weights, all > 0; returns 0 when out of memory */
+int alias_init(alias_t *a, const double *weight, int n)
+{
+    int i, s, l, nsmall = 0, nlarge = 0;
+    int *small, *large;
+    double sum = 0, *p;
+
+    a->n = n;
+    a->prob = (uint64_t *)malloc(n * sizeof(uint64_t));
+    a->alias = (int *)malloc(n * sizeof(int));
+    p = (double *)malloc(n * sizeof(double));
+    small = (int *)malloc(n * sizeof(int));
+    large = (int *)malloc(n * sizeof(int));
+    if (a->prob == NULL || a->alias == NULL || p == NULL || small == NULL || large == NULL) {
+        free(a->prob);
+        free(a->alias);
+        a->prob = NULL;
+        a->alias = NULL;
+        n = 0;
+        goto done;
+    }
+
+    for (i = 0; i < n; i++)
+        sum += weight[i];
+
+    /* scaled so that the average is 1 */
+    for (i = 0; i < n; i++) {
+        p[i] = weight[i] * n / sum;
+        if (p[i] < 1.0)
+            small[nsmall++] = i;
+        else
+            large[nlarge++] = i;
+    }
+
+    /* every small entry is topped up by a large one */
+    while (nsmall && nlarge) {
+        s = small[--nsmall];
+        l = large[nlarge - 1];
+
+        a->prob[s] = (uint64_t) (p[s] * 4294967296.0);
+        a->alias[s] = l;
+
+        p[l] -= 1.0 - p[s];
+        if (p[l] < 1.0) {
+            nlarge--;
+            small[nsmall++] = l;
+        }
+    }
+
+    /* what is left is 1 up to rounding */
+    while (nlarge) {
+        l = large[--nlarge];
+        a->prob[l] = 1ULL << 32;
+        a->alias[l] = l;
+    }
+
+    while (nsmall) {
+        s = small[--nsmall];
+        a->prob[s] = 1ULL << 32;
+        a->alias[s] = s;
+    }
+
+done:
+    free(p);
+    free(small);
+    free(large);
+
+    return n;
+}
+
+/* an entry drawn with 64 random bits */
+static inline int alias_pick(const alias_t *a, uint64_t r)
+{
+    int i = (int) (((r >> 32) * (uint64_t) a->n) >> 32);
+
+    return (r & 0xffffffff) < a->prob[i] ? i : a->alias[i];
+}
+
+void alias_free(alias_t *a)
+{
+    free(a->prob);
+    free(a->alias);
+    a->prob = NULL;
+    a->alias = NULL;
+}
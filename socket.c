@@ -25,34 +25,159 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <poll.h>
+
+/*
+ * Resolves host once for many connections, to all its IPv4 and IPv6
+ * addresses. The list is freed with freeaddrinfo() by the caller; NULL
+ * if the host is unknown.
+ */
+struct addrinfo *Resolve(const char *host, int clientPort)
+{
+    char port[16];
+    struct addrinfo hints, *res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+
+    snprintf(port, sizeof(port), "%d", clientPort);
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return NULL;
+
+    return res;
+}
+
+/*
+ * Connects a new socket to an address from Resolve(). With nonblock the
+ * connect may still be in progress: wait for the socket to become
+ * writable and check SO_ERROR before using it.
+ */
+int AddrSocket(const struct addrinfo *ai, int nonblock)
+{
+    int sock;
+
+    sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (sock < 0)
+        return sock;
+    if (nonblock && fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    if (connect(sock, ai->ai_addr, ai->ai_addrlen) < 0 && !(nonblock && errno == EINPROGRESS))
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/*
+ * Waits up to msec for the connect of a non-blocking socket from
+ * AddrSocket(): 1 once it is established, 0 if it failed or is not yet.
+ */
+int AddrConnected(int sock, int msec)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    struct pollfd pfd;
+
+    pfd.fd = sock;
+    pfd.events = POLLOUT;
+    if (poll(&pfd, 1, msec) != 1)
+        return 0;
+
+    return getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0;
+}
 
 int Socket(const char *host, int clientPort)
 {
     int sock;
-    unsigned long inaddr;
-    struct sockaddr_in ad;
-    struct hostent *hp;
-    
-    memset(&ad, 0, sizeof(ad));
-    ad.sin_family = AF_INET;
-
-    inaddr = inet_addr(host);
-    if (inaddr != INADDR_NONE)
-        memcpy(&ad.sin_addr, &inaddr, sizeof(inaddr));
+    struct addrinfo *res;
+
+    res = Resolve(host, clientPort);
+    if (res == NULL)
+        return -1;
+
+    sock = AddrSocket(res, 0);
+    freeaddrinfo(res);
+    return sock;
+}
+
+/* address:port, [address]:port for IPv6 */
+char *AddrName(const struct addrinfo *ai, char *buf, size_t size)
+{
+    char addr[INET6_ADDRSTRLEN], port[16];
+
+    if (getnameinfo(ai->ai_addr, ai->ai_addrlen, addr, sizeof(addr), port, sizeof(port),
+        NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+        snprintf(buf, size, "?");
+    else if (ai->ai_family == AF_INET6)
+        snprintf(buf, size, "[%s]:%s", addr, port);
     else
-    {
-        hp = gethostbyname(host);
-        if (hp == NULL)
+        snprintf(buf, size, "%s:%s", addr, port);
+
+    return buf;
+}
+
+/* [host]:port or host:port, split in place; *host is NULL if empty. The port, or -1 */
+int HostPort(char *s, char **host)
+{
+    char *p;
+
+    *host = s;
+    if (*s == '[') {
+        p = strchr(s, ']');
+        if (p == NULL || p[1] != ':')
+            return -1;
+
+        *p++ = '\0';
+        *host = s + 1;
+    } else {
+        p = strrchr(s, ':');
+        if (p == NULL)
             return -1;
-        memcpy(&ad.sin_addr, hp->h_addr, hp->h_length);
     }
-    ad.sin_port = htons(clientPort);
-    
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0)
-        return sock;
-    if (connect(sock, (struct sockaddr *)&ad, sizeof(ad)) < 0)
+
+    *p++ = '\0';
+    if (**host == '\0')
+        *host = NULL;
+
+    return atoi(p) > 0 ? atoi(p) : -1;
+}
+
+/* listens on host, any address if NULL, and port; -1 on error */
+int ListenSocket(const char *host, int port, int backlog)
+{
+    int sock = -1, one = 1;
+    char service[16];
+    struct addrinfo hints, *res, *ai;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0)
         return -1;
+
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock < 0)
+            continue;
+
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(sock, ai->ai_addr, ai->ai_addrlen) == 0 && listen(sock, backlog) == 0)
+            break;
+
+        close(sock);
+        sock = -1;
+    }
+
+    freeaddrinfo(res);
     return sock;
 }
-
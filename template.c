@@ -0,0 +1,103 @@
+/*
+ * Placeholders in the URL, headers and body of a request, with values of
+ * their own in every request sent: {{seq}}, the number of the request in
+ * the run, {{uuid}}, a random UUID, and {{rand:a-b}}, a random number
+ * from a to b. Each one is compiled once into a field of fixed width,
+ * numbers padded with zeros, so that a request keeps its length and is
+ * filled in by writing over its fields.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FIELD_SEQ  0
+#define FIELD_UUID 1
+#define FIELD_RAND 2
+
+#define FIELD_SEQ_WIDTH 12 /* digits, a run sends fewer requests */
+
+typedef struct {
+    int type;
+    int part; /* of the request: 0 the head, 1 the body */
+    size_t off; /* in the part */
+    int width;
+    unsigned long long lo, hi; /* of FIELD_RAND */
+} field_t;
+
+/*
+ * The placeholder at p into f, but for where it goes. Returns its
+ * length, 0 if p is not at one, -1 if it is a malformed one.
+ */
+int field_parse(const char *p, field_t *f)
+{
+    unsigned long long v;
+    const char *q;
+    char *end;
+
+    if (strncmp(p, "{{", 2) != 0)
+        return 0;
+
+    memset(f, 0, sizeof(*f));
+    if (strncmp(p + 2, "seq}}", 5) == 0) {
+        f->type = FIELD_SEQ;
+        f->width = FIELD_SEQ_WIDTH;
+        return 7;
+    }
+
+    if (strncmp(p + 2, "uuid}}", 6) == 0) {
+        f->type = FIELD_UUID;
+        f->width = UUID_SIZE;
+        return 8;
+    }
+
+    if (strncmp(p + 2, "rand:", 5) != 0)
+        return 0;
+
+    /* {{rand:a-b}} */
+    f->type = FIELD_RAND;
+    q = p + 7;
+    errno = 0;
+    if (*q < '0' || *q > '9')
+        return -1;
+
+    f->lo = strtoull(q, &end, 10);
+    if (*end != '-' || end[1] < '0' || end[1] > '9')
+        return -1;
+
+    q = end + 1;
+    f->hi = strtoull(q, &end, 10);
+    if (errno || strncmp(end, "}}", 2) != 0 || f->lo > f->hi)
+        return -1;
+
+    /* as wide as the highest value */
+    for (v = f->hi, f->width = 1; v >= 10; v /= 10)
+        f->width++;
+
+    return end + 2 - p;
+}
+
+/* the value of f in request number seq, written over the f->width characters at p */
+void field_fill(char *p, const field_t *f, unsigned long long seq, uint64_t *rng)
+{
+    unsigned long long v;
+    int i;
+
+    switch (f->type) {
+    case FIELD_UUID:
+        uuid_write(p, rng);
+        return;
+    case FIELD_SEQ:
+        v = seq;
+        break;
+    default:
+        v = f->hi - f->lo == ~0ULL ? fast_rand(rng) : f->lo + fast_rand(rng) % (f->hi - f->lo + 1);
+    }
+
+    /* the digits from the last one, zeros in front */
+    for (i = f->width - 1; i >= 0; i--) {
+        p[i] = '0' + v % 10;
+        v /= 10;
+    }
+}
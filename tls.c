@@ -0,0 +1,139 @@
+/*
+ * TLS on top of the connections, with OpenSSL.
+ *
+ * The server certificate is not verified: a benchmark talks to a server
+ * it was pointed at, often with a self-signed certificate. Reads and
+ * writes look like read() and write() on a non-blocking socket, -1 with
+ * errno EAGAIN when OpenSSL has to wait for the socket.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+/*
+ * A client context, NULL if OpenSSL could not make one. With new_session
+ * set, it gets every session a server hands out, to resume it later with
+ * SSL_set_session(); OpenSSL keeps none itself.
+ */
+SSL_CTX *tls_context(int (*new_session)(SSL *, SSL_SESSION *))
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+
+    if (ctx == NULL)
+        return NULL;
+
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+
+    /* writes resume from partial ones, out of whatever buffer holds the data then */
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    /* many servers close without close_notify, the HTTP framing tells whether it was all */
+    SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+
+    if (new_session) {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, new_session);
+    } else
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+
+    return ctx;
+}
+
+/* a TLS client on the connected socket fd, sending host as SNI unless it is an address */
+SSL *tls_new(SSL_CTX *ctx, int fd, const char *host)
+{
+    SSL *ssl = SSL_new(ctx);
+    struct in6_addr addr;
+
+    if (ssl == NULL)
+        return NULL;
+
+    if (!SSL_set_fd(ssl, fd)) {
+        SSL_free(ssl);
+        return NULL;
+    }
+
+    if (inet_pton(AF_INET, host, &addr) != 1 && inet_pton(AF_INET6, host, &addr) != 1)
+        SSL_set_tlsext_host_name(ssl, host);
+
+    SSL_set_connect_state(ssl);
+
+    return ssl;
+}
+
+/* n as returned by OpenSSL, to the read() and write() convention */
+static int tls_result(SSL *ssl, int n)
+{
+    if (n > 0)
+        return n;
+
+    switch (SSL_get_error(ssl, n)) {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    case SSL_ERROR_SYSCALL:
+        /* end of connection without close_notify, or errno is set */
+        ERR_clear_error();
+        return n == 0 ? 0 : -1;
+    default:
+        ERR_clear_error();
+        errno = EIO;
+        return -1;
+    }
+}
+
+/*
+ * Returns 1 when the handshake is done, 0 if it waits for the socket to
+ * become readable (*events EPOLLIN) or writable (EPOLLOUT), -1 on error.
+ */
+int tls_handshake(SSL *ssl, uint32_t *events)
+{
+    int n = SSL_do_handshake(ssl);
+
+    if (n == 1)
+        return 1;
+
+    switch (SSL_get_error(ssl, n)) {
+    case SSL_ERROR_WANT_READ:
+        *events = EPOLLIN;
+        return 0;
+    case SSL_ERROR_WANT_WRITE:
+        *events = EPOLLOUT;
+        return 0;
+    default:
+        ERR_clear_error();
+        return -1;
+    }
+}
+
+ssize_t tls_read(SSL *ssl, void *buf, size_t len)
+{
+    return tls_result(ssl, SSL_read(ssl, buf, len > INT_MAX ? INT_MAX : (int) len));
+}
+
+ssize_t tls_write(SSL *ssl, const void *buf, size_t len)
+{
+    return tls_result(ssl, SSL_write(ssl, buf, len > INT_MAX ? INT_MAX : (int) len));
+}
+
+/*
+ * Without close_notify, which would only cost the benchmark time, but
+ * marked as shut down: OpenSSL takes the session of a connection freed
+ * otherwise for a bad one and would not resume it.
+ */
+void tls_free(SSL *ssl)
+{
+    SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    SSL_free(ssl);
+}
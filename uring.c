@@ -0,0 +1,231 @@
+/*
+ * io_uring through its system calls, for the uring engine; there is no
+ * liburing to link. Operations are queued in the mapped submission ring
+ * and go to the kernel in one io_uring_enter(), the same call that waits
+ * for completions.
+ *
+ * The engine is built with Linux headers from 5.19 on, which have
+ * IORING_OP_SOCKET; IORING_SETUP_SQE128 came along with it and tells
+ * them apart, the operations being an enum. With older ones HAVE_URING
+ * is left undefined and the engine out, webbench falls back to epoll.
+ * The setup flags of later kernels are defined here if missing, older
+ * kernels refuse them and uring_init() does without. Whether the running
+ * kernel has what the engine needs is checked with uring_supports()
+ * before the workers start.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#ifdef IORING_SETUP_SQE128
+#define HAVE_URING 1
+#endif
+
+#ifndef IORING_SETUP_SINGLE_ISSUER
+#define IORING_SETUP_SINGLE_ISSUER (1U << 12) /* Linux 6.0 */
+#endif
+
+#ifndef IORING_SETUP_DEFER_TASKRUN
+#define IORING_SETUP_DEFER_TASKRUN (1U << 13) /* Linux 6.1 */
+#endif
+
+typedef struct {
+    int fd;
+    unsigned features; /* IORING_FEAT_* of the kernel */
+    unsigned entries; /* of the submission ring */
+    unsigned tail; /* of the submission ring, published by uring_enter() */
+    unsigned *sq_head, *sq_tail, sq_mask;
+    unsigned *cq_head, *cq_tail, cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_size, cq_size, sqes_size;
+} uring_t;
+
+void uring_free(uring_t *u)
+{
+    if (u->sqes != NULL && u->sqes != MAP_FAILED)
+        munmap(u->sqes, u->sqes_size);
+
+    if (u->cq_ring != NULL && u->cq_ring != MAP_FAILED)
+        munmap(u->cq_ring, u->cq_size);
+
+    if (u->sq_ring != NULL && u->sq_ring != MAP_FAILED)
+        munmap(u->sq_ring, u->sq_size);
+
+    if (u->fd >= 0)
+        close(u->fd);
+
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
+
+#ifdef HAVE_URING
+
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+int uring_register(uring_t *u, unsigned opcode, const void *arg, unsigned nr)
+{
+    return (int) syscall(__NR_io_uring_register, u->fd, opcode, arg, nr);
+}
+
+/*
+ * A ring of entries submissions and cq_entries completions for a single
+ * thread, that only runs the kernel's work for it while it waits in
+ * uring_enter(). Returns -1 with errno if the kernel has no io_uring or
+ * does not allow it.
+ */
+int uring_init(uring_t *u, unsigned entries, unsigned cq_entries)
+{
+    struct io_uring_params p;
+    unsigned i, *array;
+
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN
+        | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    p.cq_entries = cq_entries;
+
+    u->fd = uring_setup(entries, &p);
+    if (u->fd < 0 && errno == EINVAL) {
+        /* before Linux 6.1 */
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = cq_entries;
+        u->fd = uring_setup(entries, &p);
+    }
+
+    if (u->fd < 0)
+        return -1;
+
+    u->features = p.features;
+    u->entries = p.sq_entries;
+
+    /* mapped one by one, which works with IORING_FEAT_SINGLE_MMAP as well */
+    u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sq_ring = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+        IORING_OFF_SQ_RING);
+    u->cq_ring = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+        IORING_OFF_CQ_RING);
+    u->sqes = (struct io_uring_sqe *)mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED) {
+        uring_free(u);
+        return -1;
+    }
+
+    u->sq_head = (unsigned *) ((char *) u->sq_ring + p.sq_off.head);
+    u->sq_tail = (unsigned *) ((char *) u->sq_ring + p.sq_off.tail);
+    u->sq_mask = *(unsigned *) ((char *) u->sq_ring + p.sq_off.ring_mask);
+    u->cq_head = (unsigned *) ((char *) u->cq_ring + p.cq_off.head);
+    u->cq_tail = (unsigned *) ((char *) u->cq_ring + p.cq_off.tail);
+    u->cq_mask = *(unsigned *) ((char *) u->cq_ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) ((char *) u->cq_ring + p.cq_off.cqes);
+    u->tail = *u->sq_tail;
+
+    /* the entries are taken in order, each at its own index */
+    array = (unsigned *) ((char *) u->sq_ring + p.sq_off.array);
+    for (i = 0; i < p.sq_entries; i++)
+        array[i] = i;
+
+    return 0;
+}
+
+/* whether the kernel has all n operations ops, IORING_OP_* */
+int uring_supports(uring_t *u, const int *ops, int n)
+{
+    struct io_uring_probe *probe;
+    size_t size = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+    int i, ok = 0;
+
+    probe = (struct io_uring_probe *)calloc(1, size);
+    if (probe == NULL)
+        return 0;
+
+    if (uring_register(u, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        for (i = 0, ok = 1; i < n && ok; i++)
+            ok = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    free(probe);
+    return ok;
+}
+
+/*
+ * Send what was queued and, for up to usec, wait for a completion; with
+ * usec 0 only send. Returns the number of submissions the kernel took,
+ * -1 with errno ETIME if nothing completed in time, EINTR on a signal.
+ */
+int uring_enter(uring_t *u, unsigned long long usec)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+
+    __atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
+
+    memset(&arg, 0, sizeof(arg));
+    ts.tv_sec = usec / 1000000;
+    ts.tv_nsec = usec % 1000000 * 1000;
+    arg.ts = (uint64_t) (uintptr_t) &ts;
+
+    return (int) syscall(__NR_io_uring_enter, u->fd, u->tail - *u->sq_head, usec ? 1 : 0,
+        IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+/*
+ * Make room for n more submissions, sending the queued ones if needed: a
+ * chain of linked ones must go to the kernel in the same uring_enter().
+ * Returns -1 if there is none.
+ */
+int uring_room(uring_t *u, unsigned n)
+{
+    if (u->entries - (u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE)) >= n)
+        return 0;
+
+    uring_enter(u, 0);
+
+    return u->entries - (u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE)) >= n ? 0 : -1;
+}
+
+/* the next submission, zeroed; uring_room() made sure there is one */
+struct io_uring_sqe *uring_sqe(uring_t *u)
+{
+    struct io_uring_sqe *sqe = &u->sqes[u->tail++ & u->sq_mask];
+
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/* the oldest completion not seen yet, NULL if there is none */
+struct io_uring_cqe *uring_cqe(uring_t *u)
+{
+    unsigned head = *u->cq_head;
+
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    return &u->cqes[head & u->cq_mask];
+}
+
+/* done with the completion of uring_cqe(), its entry is the kernel's again */
+void uring_seen(uring_t *u)
+{
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* HAVE_URING */
@@ -1,40 +1,53 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #define UUID_SIZE 36
 
-char *random_uuid(char buf[UUID_SIZE + 1])
+/*
+ * xorshift64*: a few instructions per number, for workers that each
+ * keep their own state. Not for anything that must be unpredictable.
+ */
+static inline uint64_t fast_rand(uint64_t *state)
 {
-    int i, b;
-    const char *c = "89ab";
-    char *p = buf;
-
-    for(i = 0; i < 16; ++i) {
-        b = rand() % 255;
-
-        switch (i) {
-        case 6:
-            sprintf(p, "4%x", b % 15);
-            break;
-        case 8:
-            sprintf(p, "%c%x", c[rand() % strlen(c)], b % 15);
-            break;
-        default:
-            sprintf(p, "%02x", b);
-        }
-
-        p += 2;
-        switch (i) {
-        case 3:
-        case 5:
-        case 7:
-        case 9:
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+ * A random (version 4) UUID from the fast_rand() state of the caller,
+ * written over the UUID_SIZE characters at p: two numbers of it and a
+ * lookup per digit, cheap enough for every request.
+ */
+void uuid_write(char *p, uint64_t *state)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint64_t hi = fast_rand(state), lo = fast_rand(state);
+    unsigned b;
+    int i;
+
+    hi = (hi & ~0xf000ULL) | 0x4000ULL; /* version 4 */
+    lo = (lo & ~(3ULL << 62)) | 2ULL << 62; /* variant 10 */
+
+    for (i = 0; i < 16; i++) {
+        b = (i < 8 ? hi >> (56 - 8 * i) : lo >> (120 - 8 * i)) & 0xff;
+        *p++ = hex[b >> 4];
+        *p++ = hex[b & 15];
+        if (i == 3 || i == 5 || i == 7 || i == 9)
             *p++ = '-';
-        }
     }
+}
 
-    *p = '\n';
+char *random_uuid(char buf[UUID_SIZE + 1], uint64_t *state)
+{
+    uuid_write(buf, state);
+    buf[UUID_SIZE] = '\0';
 
     return buf;
 }
-
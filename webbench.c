@@ -16,8 +16,19 @@
  *    3 - internal error, fork failed
  * 
  */ 
+#define _GNU_SOURCE /* cpu_set_t */
 #include "socket.c"
 #include "uuid.c"
+#include "template.c"
+#include "http.c"
+#include "histogram.c"
+#include "scenario.c"
+#include "tls.c"
+#include "cpus.c"
+#include "agent.c"
+#include "ramp.c"
+#include "wheel.c"
+#include "uring.c"
 #include <unistd.h>
 #include <sys/param.h>
 #include <rpc/types.h>
@@ -25,6 +36,17 @@
 #include <strings.h>
 #include <time.h>
 #include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <poll.h>
 
 /* Allow: GET, POST, HEAD, OPTIONS, TRACE */
 #define METHOD_GET 0
@@ -34,10 +56,45 @@
 #define METHOD_POST 4
 #define PROGRAM_VERSION "1.6"
 
-#define POST_SIZE     1024
-#define REQUEST_SIZE  2048
+/* Engines: how the clients are driven */
+#define ENGINE_FORK  0 /* one process per client, blocking I/O */
+#define ENGINE_EPOLL 1 /* a few processes, many non-blocking clients each */
+#define ENGINE_THREAD 2 /* same as epoll, but threads of one process */
+#define ENGINE_URING 3 /* as epoll, the I/O of all clients submitted to io_uring */
+
+#define CACHE_LINE_SIZE 64
+
+/* long only options */
+#define OPT_ENGINE  256
+#define OPT_WORKERS 257
+#define OPT_PIPELINE 258
+#define OPT_RESOLVE_EVERY 259
+#define OPT_RATE 260
+#define OPT_INTERVAL 261
+#define OPT_ANY_STATUS 262
+#define OPT_URLS 263
+#define OPT_OUTPUT 264
+#define OPT_OUTPUT_FILE 265
+#define OPT_TLS_REUSE 266
+#define OPT_CPUS 267
+#define OPT_AVOID_CPUS 268
+#define OPT_PIN 269
+#define OPT_AGENT 270
+#define OPT_COORDINATOR 271
+#define OPT_AGENT_FD 272 /* internal, a run of an agent */
+#define OPT_RAMP 273
+#define OPT_CONNECT_TIMEOUT 274
+#define OPT_RESPONSE_TIMEOUT 275
+
+/* --output formats */
+#define OUTPUT_NONE 0
+#define OUTPUT_JSON 1
+#define OUTPUT_CSV  2
+
 #define MAX_BUF_SIZE  2048
 #define BOUNDARY_SIZE 57
+#define PIPELINE_MAX  512 /* 2 iovecs a request, IOV_MAX is 1024 on Linux */
+#define REQUEST_IOVS  4   /* and 2 more for the file of a multipart one, never pipelined */
 
 #define POST_MIME_URLENCODED                    "application/x-www-form-urlencoded"
 #define POST_MIME_MULTIFORM                     "multipart/form-data; boundary="
@@ -46,20 +103,52 @@
 #define POST_CONTENT_DISPOSITION_FILENAME_END   "\""
 #define POST_CONTENT_DISPOSITION_CONTENT_TYPE   "Content-Type: application/octet-stream" 
 
+/* connection states of the epoll engine */
+#define CONN_IDLE       0
+#define CONN_CONNECTING 1
+#define CONN_WRITING    2
+#define CONN_READING    3
+#define CONN_HANDSHAKE  4 /* TLS, after connecting */
+#define CONN_CLOSING    5 /* the uring engine, until the kernel closed it */
+#define CONN_BACKOFF    6 /* no socket could be made, waits to try again */
+
+#define CONN_BACKOFF_MSEC 100 /* before a client tries again to make a socket */
+
+/* operations of the uring engine, in the user_data of their completions */
+#define URING_SOCKET   0
+#define URING_CONNECT  1
+#define URING_SEND     2
+#define URING_RECV     3
+#define URING_SHUTDOWN 4
+#define URING_CLOSE    5
+
+/* connection, its closes so far and the operation */
+#define URING_DATA(w, c, op) \
+    ((uint64_t) ((c) - (w)->conns) << 32 | (uint64_t) ((c)->gen & 0xffffff) << 8 | (op))
+
+#define URING_BUF_SIZE 4096 /* of every connection of the uring engine, for its reads */
+
+/* Phases of a request, timed each */
+#define PHASE_CONNECT 0 /* connect() until established, new connections only */
+#define PHASE_SEND    1 /* first until last byte of the request written */
+#define PHASE_WAIT    2 /* request written until the first byte of the response */
+#define PHASE_RECEIVE 3 /* first until last byte of the response */
+#define PHASES        4
+
 /* values */
 volatile int timerexpired = 0;
 
 typedef struct {
     int succeeded;
     int failed;
+    int timedout; /* of the failed, by --connect-timeout or --response-timeout */
     long bytes;
+    int status[6]; /* responses by status class, [0] without a status line */
 } statistics_t;
 
 typedef struct {
     int post;
     int in_file;
-    FILE *file;
-    long offset;
     char *boundary;
     char *content;
 } post_t;
@@ -83,14 +172,221 @@ typedef struct {
     int force;
     int force_reload;
     int benchtime;
+    int engine;
+    int workers;
+    int keepalive;
+    int pipeline; /* requests written back to back on a connection */
+    int resolve_every; /* look the host up for each connection */
+    double rate; /* requests per second of all clients, 0 for closed loop */
+    int interval; /* seconds between live reports, 0 for none */
+    int any_status; /* responses count as succeeded whatever their status */
+    const char *urls; /* scenario file instead of one URL */
+    const char *url; /* the one URL, without --urls */
+    int output; /* format of the results file */
+    const char *output_file;
+    int tls; /* https:// */
+    int tls_reuse; /* resume TLS sessions instead of full handshakes */
+    const char *cpus; /* the workers run on */
+    const char *avoid_cpus; /* left to the server */
+    int pin; /* each worker to a CPU of its own */
+    const char *agent; /* [host]:port to take runs on */
+    const char *coordinator; /* agents to run on, host:port,... */
+    const char *ramp; /* stages of clients or rate, instead of -c or --rate */
+    int connect_timeout; /* msec, 0 for none */
+    int response_timeout;
 
     proxy_t proxy;
     post_t post;
     header_t header;
 } bench_params_t;
 
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+} strbuf_t;
+
+/* a request, built once before the workers start and only read by them */
+typedef struct {
+    int method;
+    char *url;        /* for the report of --urls */
+    strbuf_t head;    /* request line, headers and the empty line */
+    strbuf_t body;    /* url encoded content or multipart preamble */
+    strbuf_t trailer; /* multipart closing boundary, sent after the file */
+    const char *file; /* multipart file, mapped once for all workers */
+    size_t file_len;
+    struct iovec iov[REQUEST_IOVS]; /* head, body, file and trailer */
+    size_t len;       /* of all of them */
+    struct iovec *piov; /* the non-empty ones, bench_params.pipeline times */
+    int npiov;
+    field_t *fields; /* placeholders of the head and body, filled in for every request */
+    int nfields;
+} request_t;
+
+/* per --urls entry or server address and worker, beside the worker's shard */
+typedef struct {
+    int succeeded;
+    int failed;
+    unsigned long long sum; /* latency, usec */
+    unsigned long long max;
+} entry_stats_t;
+
+/* an address of the server, connections take turns */
+typedef struct {
+    const struct addrinfo *ai;
+    int at; /* place in the answer of the resolver */
+    char name[INET6_ADDRSTRLEN + 16];
+} target_t;
+
+typedef struct {
+    int fd;
+    int state;
+    size_t sent; /* bytes of the (pipelined) request already written */
+    uint32_t events; /* epoll events waited for */
+    int reused; /* requests completed on this connection */
+    int pending; /* responses still expected for the written requests */
+    unsigned long long start; /* usec, when the request was started */
+    const request_t *req; /* being sent */
+    struct iovec *piov; /* what is sent of it: req->piov, or with fields the connection's own */
+    const request_t *copied; /* to the connection's own iovecs, whose fields only change */
+    int target; /* connected to */
+    SSL *ssl; /* with https:// */
+    unsigned long long shake; /* usec, when the TLS handshake started */
+
+    /* usec, for the phases */
+    unsigned long long connecting; /* connect() was called */
+    unsigned long long sending; /* the first byte of the request went out */
+    unsigned long long written; /* the last one, 0 once the response began */
+    unsigned long long first; /* byte of the response being read, 0 before */
+    wheel_entry_t timer; /* --connect-timeout or --response-timeout */
+    http_response_t resp;
+
+    /* the uring engine */
+    unsigned gen; /* closes so far, completions of older ones are stale */
+    int busy; /* an operation on the socket has not completed yet */
+} conn_t;
+
+/* per process state of the epoll engine */
+typedef struct {
+    int epfd;
+    int nconns;
+    conn_t *conns;
+    conn_t **idle; /* connections waiting for (re)connect */
+    int nidle;
+
+    const char *host;
+    int port;
+    int next_target; /* of the next connection */
+    const request_t *req; /* the nrequests entries */
+    struct iovec *iov; /* scratch for a partial write of c->piov */
+    entry_stats_t *entries; /* with --urls */
+    entry_stats_t *targets; /* with more than one address */
+    uint64_t rng;
+    unsigned long long seq; /* requests of this worker filled in so far */
+    char *texts; /* text_size for every connection, the head and body with fields */
+    size_t text_size;
+    struct iovec *iovs; /* their pipelined iovecs, REQUEST_IOVS * pipeline each */
+    SSL_SESSION *session; /* the last one the server gave, with --tls-reuse */
+
+    /* --ramp */
+    int no; /* of count workers */
+    int count;
+    int active; /* clients that may run now, of nconns */
+    int stage; /* the requests count into now */
+    unsigned long long ramp_until; /* usec, active and interval hold until */
+    entry_stats_t *stages; /* per stage */
+
+    /* --rate schedule, usec */
+    double interval; /* between requests of this worker, 0 for closed loop */
+    unsigned long long base; /* slot of the first request */
+    unsigned long long scheduled; /* requests started so far */
+    unsigned long long next; /* slot of the next request */
+    unsigned long long armed; /* slot timerfd is set to */
+    int timerfd;
+
+    statistics_t *stats;
+    histogram_t *latency;
+    histogram_t *handshakes; /* TLS, [0] full and [1] resumed */
+    histogram_t *phases; /* PHASES of them */
+    struct epoll_event *events;
+    int nevents;
+    wheel_t wheel; /* deadlines of the connections */
+
+    /* the uring engine, ring is NULL with the others */
+    uring_t *ring;
+    char *bufs; /* URING_BUF_SIZE for every connection */
+    int fixed_bufs; /* bufs is registered with the ring, read with READ_FIXED */
+    struct msghdr *msgs; /* of the requests being sent, until they complete */
+
+    char buf[MAX_BUF_SIZE];
+} worker_t;
+
+/* counters of one worker thread, on cache lines of their own */
+typedef struct {
+    statistics_t stats;
+    histogram_t latency;
+    histogram_t handshakes[2]; /* TLS, full and resumed */
+    histogram_t phases[PHASES];
+} __attribute__((aligned(CACHE_LINE_SIZE))) shard_t;
+
+/*
+ * Shard counters have a single writer, their worker, and are read while
+ * it runs: relaxed atomics keep each value whole without any ordering
+ * or locked instructions.
+ */
+#define STAT_ADD(v, n) __atomic_store_n(&(v), (v) + (n), __ATOMIC_RELAXED)
+#define STAT_GET(v)    __atomic_load_n(&(v), __ATOMIC_RELAXED)
+#define STAT_SET(v, x) __atomic_store_n(&(v), (x), __ATOMIC_RELAXED)
+
+/* counts of a second of the run, for --output */
+typedef struct {
+    int succeeded;
+    int failed;
+    long bytes;
+} sample_t;
+
+/* --interval reports and the --output time series, sampled from the shards */
+typedef struct {
+    statistics_t last; /* sums at the previous sample */
+    statistics_t shown; /* at the previous --interval report */
+    unsigned long long start; /* usec */
+    unsigned long long at; /* of the previous sample */
+    unsigned long long shown_at;
+    unsigned long long next; /* of the next sample */
+    unsigned long long every; /* usec between samples, 0 for none */
+    sample_t *series; /* one per second with --output */
+    int nseries;
+} sampler_t;
+
+/* what an agent sends at the end of its run */
+typedef struct {
+    statistics_t stats;
+    histogram_t latency;
+    histogram_t handshakes[2];
+    histogram_t phases[PHASES];
+} agent_result_t;
+
+/* an agent of the coordinator */
+typedef struct {
+    char name[MAXHOSTNAMELEN + 16]; /* host:port as given */
+    int fd;
+    int done;
+    int lost; /* the connection ended before the results came */
+    int nsamples; /* seconds received */
+    statistics_t stats;
+} agent_t;
+
+/* --output writer: nested JSON objects, or CSV lines of dotted name and value */
+typedef struct {
+    FILE *file;
+    int format;
+    int first; /* nothing written yet in the current object */
+    int depth;
+    char prefix[64];
+} output_t;
+
 statistics_t statistics = {
-    0, 0, 0
+    0, 0, 0, 0, { 0 }
 };
 
 bench_params_t bench_params = {
@@ -100,15 +396,66 @@ bench_params_t bench_params = {
     0,
     0,
     30,
+    ENGINE_FORK,
+    0,
+    0,
+    1,
+    0,
+    0,
+    0,
+    0,
+    NULL,
+    NULL,
+    OUTPUT_NONE,
+    NULL,
+    0,
+    0,
+    NULL,
+    NULL,
+    0,
+    NULL,
+    NULL,
+    NULL,
+    0,
+    0,
     { 80, NULL },
-    { 0, 0, NULL, 0, NULL, NULL },
+    { 0, 0, NULL, NULL },
     { 0, NULL, NULL }
 };
 
 /* internal */
-int mypipe[2];
+shard_t *shards; /* one per worker, shared with the parent */
+shard_t *shard; /* of this process */
+entry_stats_t *entry_stats; /* nrequests per worker, with --urls */
+entry_stats_t *entry_stat; /* of this process */
+entry_stats_t *target_stats; /* ntargets per worker, with more than one */
+entry_stats_t *target_stat; /* of this process */
 char host[MAXHOSTNAMELEN];
-char request[REQUEST_SIZE];
+struct addrinfo *resolved; /* server or proxy, resolved once */
+target_t *targets; /* the addresses of it that could be connected to */
+int ntargets;
+request_t *requests; /* one, or the entries of --urls */
+int nrequests;
+alias_t picker; /* draws the entry of the next request */
+FILE *output_file; /* opened before the benchmark, so a bad path fails early */
+SSL_CTX *tls_ctx; /* with https:// */
+cpu_set_t cpuset; /* of --cpus and --avoid-cpus */
+int agent_fd = -1; /* to the coordinator, in a run of an agent */
+stage_t *stages; /* of --ramp */
+int nstages;
+int ramp_rate; /* the stages are rates, not clients */
+unsigned long long run_start; /* usec, when the workers begin */
+entry_stats_t *stage_stats; /* nstages per worker, with --ramp */
+entry_stats_t *stage_stat; /* of this process */
+entry_stats_t *stage_totals; /* of all workers, once they are done */
+
+static const char *engine_names[] = {
+    "fork", "epoll", "thread", "uring"
+};
+
+static const char *phase_names[] = {
+    "connect", "send", "wait", "receive"
+};
 
 static const struct option long_options[] =
 {
@@ -129,13 +476,67 @@ static const struct option long_options[] =
     {"version",  no_argument,        NULL,                        'V'},
     {"proxy",    required_argument,  NULL,                        'p'},
     {"clients",  required_argument,  NULL,                        'c'},
+    {"engine",   required_argument,  NULL,                        OPT_ENGINE},
+    {"workers",  required_argument,  NULL,                        OPT_WORKERS},
+    {"keepalive", no_argument,       NULL,                        'k'},
+    {"pipeline", required_argument,  NULL,                        OPT_PIPELINE},
+    {"resolve-every", no_argument,   NULL,                        OPT_RESOLVE_EVERY},
+    {"rate",     required_argument,  NULL,                        OPT_RATE},
+    {"interval", required_argument,  NULL,                        OPT_INTERVAL},
+    {"any-status", no_argument,      NULL,                        OPT_ANY_STATUS},
+    {"urls",     required_argument,  NULL,                        OPT_URLS},
+    {"output",   required_argument,  NULL,                        OPT_OUTPUT},
+    {"output-file", required_argument, NULL,                      OPT_OUTPUT_FILE},
+    {"tls-reuse", no_argument,       NULL,                        OPT_TLS_REUSE},
+    {"cpus",     required_argument,  NULL,                        OPT_CPUS},
+    {"avoid-cpus", required_argument, NULL,                       OPT_AVOID_CPUS},
+    {"pin",      no_argument,        NULL,                        OPT_PIN},
+    {"agent",    required_argument,  NULL,                        OPT_AGENT},
+    {"coordinator", required_argument, NULL,                      OPT_COORDINATOR},
+    {"agent-fd", required_argument,  NULL,                        OPT_AGENT_FD},
+    {"ramp",     required_argument,  NULL,                        OPT_RAMP},
+    {"connect-timeout", required_argument, NULL,                  OPT_CONNECT_TIMEOUT},
+    {"response-timeout", required_argument, NULL,                 OPT_RESPONSE_TIMEOUT},
     {NULL,       0,                  NULL,                         0}
 };
 
 /* prototypes */
-static void benchcore(const char* host, const int port, char *request);
+static void benchcore(const char* host, const int port, const request_t *req, int no);
+static int bench_threads(const char *host, const int port);
+static void report(const histogram_t *latency, const histogram_t *handshakes, const histogram_t *phases);
+static void report_details(const entry_stats_t *stats, int n, int count, const char *what);
+static void report_stages(void);
+static void stages_sum(const entry_stats_t *stats, int n);
+static void shards_sum(statistics_t *sum, int n);
+static void shards_merge(histogram_t *latency, histogram_t *handshakes, histogram_t *phases, int n);
+static unsigned long long now_usec(void);
+static void sampler_init(sampler_t *sp, unsigned long long start);
+static int sampler_wait(sampler_t *sp);
+static void sampler_sample(sampler_t *sp, int n);
+static void sampler_free(sampler_t *sp);
+static int write_output(const histogram_t *latency, const histogram_t *handshakes, const histogram_t *phases,
+    const sampler_t *sp);
+static void benchcore_epoll(const char *host, const int port, const request_t *req, int nconns, int no);
 static int bench(void);
-static void build_request(const char *url);
+static void request_version(int method);
+static void build_request(request_t *req, const char *url);
+static int build_special_request(request_t *req, const header_t *extra, const char *content);
+static int load_urls(const char *file);
+static int conn_release(conn_t *c);
+static int tls_new_session(SSL *ssl, SSL_SESSION *session);
+static void worker_place(int no);
+#ifdef HAVE_URING
+static struct io_uring_sqe *conn_sqe(worker_t *w, conn_t *c, int opcode, int op);
+#endif
+static void conn_submit_connect(worker_t *w, conn_t *c);
+static void conn_submit_send(worker_t *w, conn_t *c);
+static void conn_submit_close(worker_t *w, conn_t *c);
+static void benchcore_uring(const char *host, const int port, const request_t *req, int nconns, int no);
+static const char *uring_missing(void);
+static int agent_serve(const char *self);
+static int agent_start(void);
+static void agent_done(const histogram_t *latency, const histogram_t *handshakes, const histogram_t *phases);
+static int coordinate(void);
 
 static void alarm_handler(int signal)
 {
@@ -150,11 +551,47 @@ static void usage(void)
 {
    fprintf(stderr,
     "webbench [option]... URL\n"
+    "webbench [option]... --urls <file>\n"
+    "webbench --agent [host]:port [--cpus <list>] [--avoid-cpus <list>] [--pin]\n"
     "  -f|--force               Don't wait for reply from server.\n"
     "  -r|--reload              Send reload request - Pragma: no-cache.\n"
+    "  -k|--keepalive           Reuse connections (HTTP/1.1 keep-alive).\n"
+    "  --any-status             Count responses of any status as successful,\n"
+    "                           not only 2xx.\n"
+    "  --pipeline <n>           Write <n> requests back to back on a connection\n"
+    "                           before reading the responses, implies -k.\n"
     "  -t|--time <sec>          Run benchmark for <sec> seconds. Default 30.\n"
+    "  --interval <sec>         Print requests, failures and bytes per second\n"
+    "                           every <sec> seconds while running.\n"
+    "  --output <format>        Also write the parameters, totals, latency\n"
+    "                           percentiles and per second counts of the run\n"
+    "                           to a file, as json or csv.\n"
+    "  --output-file <file>     The file of --output. Default webbench.<format>.\n"
     "  -p|--proxy <server:port> Use proxy server for request.\n"
+    "  --tls-reuse              Resume TLS sessions of https:// URLs, so new\n"
+    "                           connections skip the full handshake.\n"
     "  -c|--clients <n>         Run <n> HTTP clients at once. Default one.\n"
+    "  --rate <n>               Start <n> requests per second in all, whether\n"
+    "                           or not earlier ones were answered.\n"
+    "  --ramp <stages>          Change the clients or the rate in stages, as\n"
+    "                           100:30s,0-500:1m or 1000/s:30s, each reported.\n"
+    "  --resolve-every          Resolve the server name for each connection,\n"
+    "                           instead of once before the benchmark.\n"
+    "  --connect-timeout <ms>   Give up on a connection not established, TLS\n"
+    "                           handshake included, in <ms> milliseconds.\n"
+    "  --response-timeout <ms>  Give up on a request not answered in full in\n"
+    "                           <ms> milliseconds from when it is sent.\n"
+    "  --engine <name>          fork: one process per client (default),\n"
+    "                           epoll: few processes, non-blocking clients,\n"
+    "                           thread: as epoll, with threads of one process,\n"
+    "                           uring: as epoll, with io_uring (Linux 5.19).\n"
+    "  --workers <n>            Processes or threads of the epoll, thread and\n"
+    "                           uring engines. Default CPUs.\n"
+    "  --cpus <list>            Run the workers on these CPUs only, as 0-3,8.\n"
+    "  --avoid-cpus <list>      Keep the workers off these CPUs, e.g. those of\n"
+    "                           the server when it runs on the same machine.\n"
+    "  --pin                    Pin each worker to a CPU of its own, in turn,\n"
+    "                           with its memory on the NUMA node of that CPU.\n"
     "  -9|--http09              Use HTTP/0.9 style requests.\n"
     "  -1|--http10              Use HTTP/1.0 protocol.\n"
     "  -2|--http11              Use HTTP/1.1 protocol.\n"
@@ -165,11 +602,78 @@ static void usage(void)
     "  -o|--post                Use POST request method.\n"
     "  -i|--file                Use multipart/form-data for POST request method.\n"
     "  -d|--header <header:xxx> Specify custom header.\n"
+    "  --urls <file>            Send a weighted mix of requests, a line each:\n"
+    "                           weight method url [-d header:xxx]... [-o content]\n"
+    "  --agent [host]:port      Wait for runs from a coordinator on port, of\n"
+    "                           loopback unless host is given. Anyone who\n"
+    "                           reaches it may start runs.\n"
+    "  --coordinator <agents>   Run the benchmark on the agents host:port,...\n"
+    "                           at once, the clients and rate split among them.\n"
     "  -?|-h|--help             This information.\n"
     "  -V|--version             Display program version.\n"
+    "The URL, headers and POST content may have {{seq}}, {{uuid}} and\n"
+    "{{rand:a-b}}, a new value in every request sent.\n"
     );
 };
 
+static void strbuf_append(strbuf_t *b, const char *s, size_t len)
+{
+    size_t size = b->size ? b->size : 256;
+    char *p;
+
+    if (b->len + len + 1 > b->size) {
+        while (size < b->len + len + 1)
+            size *= 2;
+
+        p = (char *)realloc(b->data, size);
+        if (p == NULL) {
+            fprintf(stderr, "Error in alloc for request.\n");
+            exit(3);
+        }
+
+        b->data = p;
+        b->size = size;
+    }
+
+    memcpy(b->data + b->len, s, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+}
+
+static void strbuf_cat(strbuf_t *b, const char *s)
+{
+    strbuf_append(b, s, strlen(s));
+}
+
+static void strbuf_printf(strbuf_t *b, const char *fmt, ...)
+{
+    char str[256], *p = str;
+    int n;
+    va_list ap;
+
+    va_start(ap, fmt);
+    n = vsnprintf(str, sizeof(str), fmt, ap);
+    va_end(ap);
+
+    if (n >= (int) sizeof(str)) {
+        p = (char *)malloc(n + 1);
+        if (p == NULL) {
+            fprintf(stderr, "Error in alloc for request.\n");
+            exit(3);
+        }
+
+        va_start(ap, fmt);
+        vsnprintf(p, n + 1, fmt, ap);
+        va_end(ap);
+    }
+
+    if (n > 0)
+        strbuf_append(b, p, n);
+
+    if (p != str)
+        free(p);
+}
+
 static int init_header(int count)
 {
     int new_add = 0;
@@ -240,12 +744,17 @@ static void free_header(void)
 
     if (bench_params.header.value)
         free(bench_params.header.value);
+
+    bench_params.header.key = NULL;
+    bench_params.header.value = NULL;
 }
 
 static void free_boundary(void)
 {
     if (bench_params.post.boundary)
         free(bench_params.post.boundary);
+
+    bench_params.post.boundary = NULL;
 }
 
 int main(int argc, char *argv[])
@@ -255,13 +764,16 @@ int main(int argc, char *argv[])
     int options_index = 0;
     char uuid[UUID_SIZE + 1];
     char *tmp = NULL;
+    const char *missing;
+    uint64_t rng;
+    cpu_set_t avoid;
 
     if(argc == 1) {
         usage();
         goto failed;
     }
 
-    while((opt = getopt_long(argc, argv, "912Vfrt:p:c:d:o:i?h", long_options, &options_index)) != EOF) {
+    while((opt = getopt_long(argc, argv, "912Vfrkt:p:c:d:o:i?h", long_options, &options_index)) != EOF) {
         switch(opt) {
         case 0:
             break;
@@ -271,6 +783,9 @@ int main(int argc, char *argv[])
         case 'r':
             bench_params.force_reload = 1;
             break;
+        case 'k':
+            bench_params.keepalive = 1;
+            break;
         case '9':
             bench_params.http_version = 0;
             break;
@@ -290,9 +805,22 @@ int main(int argc, char *argv[])
 
             break;
         case 'p':
-            /* proxy server parsing server:port */
-            tmp = strrchr(optarg, ':');
+            /* proxy server parsing server:port or [address]:port */
             bench_params.proxy.proxyhost = optarg;
+            if (*optarg == '[') {
+                tmp = strchr(optarg, ']');
+                if (tmp == NULL || (tmp[1] != '\0' && tmp[1] != ':')) {
+                    fprintf(stderr, "Error in option --proxy %s: IPv6 address must be in [].\n", optarg);
+                    goto failed;
+                }
+
+                *tmp++ = '\0';
+                bench_params.proxy.proxyhost = optarg + 1;
+                if (*tmp == '\0')
+                    break;
+            } else
+                tmp = strrchr(optarg, ':');
+
             if(tmp == NULL)
                 break;
 
@@ -353,29 +881,252 @@ int main(int argc, char *argv[])
             bench_params.header.value[header_count - 1] = tmp;
             break;
         case 'o':
-            if (strlen(optarg) > POST_SIZE) {
-                fprintf(stderr, "Error in option --post %s: Content or file name too large.\n", optarg);
-                goto failed;
-            }
-
             bench_params.method = METHOD_POST;
             bench_params.post.post = 1;
             bench_params.post.content = optarg;
             break;
         case 'i':
             bench_params.post.in_file = 1;
+            break;
+        case OPT_ENGINE:
+            if (strcmp(optarg, "fork") == 0)
+                bench_params.engine = ENGINE_FORK;
+            else if (strcmp(optarg, "epoll") == 0)
+                bench_params.engine = ENGINE_EPOLL;
+            else if (strcmp(optarg, "thread") == 0)
+                bench_params.engine = ENGINE_THREAD;
+            else if (strcmp(optarg, "uring") == 0)
+                bench_params.engine = ENGINE_URING;
+            else {
+                fprintf(stderr, "Error in option --engine %s: Unknown engine.\n", optarg);
+                goto failed;
+            }
+
+            break;
+        case OPT_PIPELINE:
+            bench_params.pipeline = atoi(optarg);
+            if (bench_params.pipeline <= 0 || bench_params.pipeline > PIPELINE_MAX) {
+                fprintf(stderr, "Error in option --pipeline %s: Must be between 1 and %d.\n", optarg, PIPELINE_MAX);
+                goto failed;
+            }
+
+            if (bench_params.pipeline > 1)
+                bench_params.keepalive = 1;
+
+            break;
+        case OPT_RATE:
+            bench_params.rate = atof(optarg);
+            if (bench_params.rate <= 0) {
+                fprintf(stderr, "Error in option --rate %s: Must be greater than 0.\n", optarg);
+                goto failed;
+            }
+
+            break;
+        case OPT_URLS:
+            bench_params.urls = optarg;
+            break;
+        case OPT_ANY_STATUS:
+            bench_params.any_status = 1;
+            break;
+        case OPT_OUTPUT:
+            if (strcmp(optarg, "json") == 0)
+                bench_params.output = OUTPUT_JSON;
+            else if (strcmp(optarg, "csv") == 0)
+                bench_params.output = OUTPUT_CSV;
+            else {
+                fprintf(stderr, "Error in option --output %s: Unknown format, json or csv.\n", optarg);
+                goto failed;
+            }
+
+            break;
+        case OPT_OUTPUT_FILE:
+            bench_params.output_file = optarg;
+            break;
+        case OPT_TLS_REUSE:
+            bench_params.tls_reuse = 1;
+            break;
+        case OPT_CPUS:
+            bench_params.cpus = optarg;
+            if (!cpus_parse(optarg, &cpuset)) {
+                fprintf(stderr, "Error in option --cpus %s: Bad CPU list.\n", optarg);
+                goto failed;
+            }
+
+            break;
+        case OPT_AVOID_CPUS:
+            bench_params.avoid_cpus = optarg;
+            if (!cpus_parse(optarg, &avoid)) {
+                fprintf(stderr, "Error in option --avoid-cpus %s: Bad CPU list.\n", optarg);
+                goto failed;
+            }
+
+            break;
+        case OPT_PIN:
+            bench_params.pin = 1;
+            break;
+        case OPT_AGENT:
+            bench_params.agent = optarg;
+            break;
+        case OPT_COORDINATOR:
+            bench_params.coordinator = optarg;
+            break;
+        case OPT_AGENT_FD:
+            agent_fd = atoi(optarg);
+            /* the parent that streams to the coordinator is no worker */
+            signal(SIGPIPE, SIG_IGN);
+            break;
+        case OPT_RAMP:
+            bench_params.ramp = optarg;
+            nstages = ramp_parse(optarg, &stages, &ramp_rate);
+            if (nstages == 0) {
+                fprintf(stderr, "Error in option --ramp %s: Bad stages, as 100:30s,0-500:1m or 1000/s:30s.\n", optarg);
+                goto failed;
+            }
+
+            break;
+        case OPT_CONNECT_TIMEOUT:
+            bench_params.connect_timeout = atoi(optarg);
+            if (bench_params.connect_timeout <= 0) {
+                fprintf(stderr, "Error in option --connect-timeout %s: Must be greater than 0.\n", optarg);
+                goto failed;
+            }
+
+            break;
+        case OPT_RESPONSE_TIMEOUT:
+            bench_params.response_timeout = atoi(optarg);
+            if (bench_params.response_timeout <= 0) {
+                fprintf(stderr, "Error in option --response-timeout %s: Must be greater than 0.\n", optarg);
+                goto failed;
+            }
+
+            break;
+        case OPT_INTERVAL:
+            bench_params.interval = atoi(optarg);
+            if (bench_params.interval <= 0) {
+                fprintf(stderr, "Error in option --interval %s: Must be greater than 0.\n", optarg);
+                goto failed;
+            }
+
+            break;
+        case OPT_RESOLVE_EVERY:
+            bench_params.resolve_every = 1;
+            break;
+        case OPT_WORKERS:
+            bench_params.workers = atoi(optarg);
+            if (bench_params.workers <= 0)
+                fprintf(stderr, "Warning in option --workers %s: Invalid workers, defaults to CPUs.\n", optarg);
+
             break;
         default:
             break;
         }
     }
 
-    if(optind == argc) {
+    /* --ramp sets the time, and the clients or the rate at their most */
+    if (nstages) {
+        if (bench_params.rate > 0) {
+            fprintf(stderr, "Error in option --ramp: can not be used with --rate, stages are rates as 1000/s.\n");
+            goto failed;
+        }
+
+        if (ramp_max(stages, nstages) <= 0) {
+            fprintf(stderr, "Error in option --ramp %s: Nothing to run.\n", bench_params.ramp);
+            goto failed;
+        }
+
+        bench_params.benchtime = (int) (stages[nstages - 1].end / 1000000);
+        if (ramp_rate)
+            bench_params.rate = ramp_max(stages, nstages);
+        else {
+            bench_params.clients = (int) ramp_max(stages, nstages);
+            if (bench_params.clients < ramp_max(stages, nstages))
+                bench_params.clients++;
+        }
+    }
+
+    if (bench_params.clients <= 0)
+        bench_params.clients = 1;
+
+    /* the whole process keeps to the CPUs, workers inherit it */
+    if (bench_params.cpus != NULL || bench_params.avoid_cpus != NULL || bench_params.pin) {
+        if (bench_params.cpus == NULL && sched_getaffinity(0, sizeof(cpuset), &cpuset)) {
+            perror("sched_getaffinity failed.");
+            goto failed;
+        }
+
+        for (i = 0; bench_params.avoid_cpus != NULL && i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &avoid))
+                CPU_CLR(i, &cpuset);
+        }
+
+        if (CPU_COUNT(&cpuset) == 0) {
+            fprintf(stderr, "Error in option --cpus: No CPU left to run on.\n");
+            goto failed;
+        }
+
+        if (sched_setaffinity(0, sizeof(cpuset), &cpuset)) {
+            fprintf(stderr, "Error in option --cpus: %s.\n", strerror(errno));
+            goto failed;
+        }
+    }
+
+    if (bench_params.agent != NULL)
+        return agent_serve(argv[0]);
+
+    /* agents choose their number of workers, unless it was given */
+    if (bench_params.engine != ENGINE_FORK && bench_params.coordinator == NULL) {
+        if (bench_params.workers <= 0 && CPU_COUNT(&cpuset))
+            bench_params.workers = CPU_COUNT(&cpuset);
+        else if (bench_params.workers <= 0)
+            bench_params.workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (bench_params.workers <= 0)
+            bench_params.workers = 1;
+
+        if (bench_params.workers > bench_params.clients)
+            bench_params.workers = bench_params.clients;
+    }
+
+    if(optind == argc && bench_params.urls == NULL) {
         fprintf(stderr, "webbench: Missing URL!\n");
         usage();
         goto failed;
     }
 
+    if (bench_params.urls != NULL) {
+        if (optind < argc) {
+            fprintf(stderr, "Error in option --urls: can not be used with a URL.\n");
+            goto failed;
+        }
+
+        if (bench_params.post.post) {
+            fprintf(stderr, "Error in option --urls: can not be used with -o|--post, bodies are given per URL.\n");
+            goto failed;
+        }
+    }
+
+    /* agents take no files of the coordinator's options */
+    if (bench_params.coordinator != NULL && (bench_params.urls != NULL || bench_params.post.in_file)) {
+        fprintf(stderr, "Error in option --coordinator: can not be used with --urls or -i|--file, agents read no files.\n");
+        goto failed;
+    }
+
+    if (bench_params.output_file != NULL && bench_params.output == OUTPUT_NONE) {
+        fprintf(stderr, "Error in option --output-file: --output not specified.\n");
+        goto failed;
+    }
+
+    if (bench_params.output != OUTPUT_NONE) {
+        if (bench_params.output_file == NULL)
+            bench_params.output_file = bench_params.output == OUTPUT_JSON ? "webbench.json" : "webbench.csv";
+
+        output_file = fopen(bench_params.output_file, "w");
+        if (output_file == NULL) {
+            fprintf(stderr, "Error in option --output-file %s: %s.\n", bench_params.output_file, strerror(errno));
+            goto failed;
+        }
+    }
+
     if (bench_params.post.in_file) {
         if (!bench_params.post.post) {
             fprintf(stderr, "Error in option -i|--file: --post not specified.\n");
@@ -389,7 +1140,8 @@ int main(int argc, char *argv[])
         }
 
         strcat(bench_params.post.boundary, "-------------------------");
-        random_uuid(uuid);
+        rng = (now_usec() << 20 ^ (uint64_t) getpid()) | 1;
+        random_uuid(uuid, &rng);
         snprintf(bench_params.post.boundary + strlen(bench_params.post.boundary), 9, "%s", uuid);
         snprintf(bench_params.post.boundary + strlen(bench_params.post.boundary), 5, "%s", uuid + 9);
         snprintf(bench_params.post.boundary + strlen(bench_params.post.boundary), 5, "%s", uuid + 14);
@@ -425,6 +1177,14 @@ int main(int argc, char *argv[])
     /* print bench info */
     printf("\nBenchmarking: ");
 
+    if (bench_params.urls != NULL) {
+        if (!load_urls(bench_params.urls))
+            goto failed;
+
+        printf("%d URLs from %s", nrequests, bench_params.urls);
+        goto version;
+    }
+
     switch(bench_params.method) {
     case METHOD_GET:
     default:
@@ -443,8 +1203,18 @@ int main(int argc, char *argv[])
         printf("POST");
     }
 
-    build_request(argv[optind]);
-    printf(" %s", argv[optind]);
+    requests = (request_t *)calloc(1, sizeof(request_t));
+    if (requests == NULL) {
+        fprintf(stderr, "Error in alloc for request.\n");
+        goto failed;
+    }
+
+    nrequests = 1;
+    requests[0].method = bench_params.method;
+    request_version(bench_params.method);
+    bench_params.url = argv[optind];
+    build_request(&requests[0], bench_params.url);
+    printf(" %s", bench_params.url);
 
     if (bench_params.post.post) {
         if (!bench_params.post.in_file)
@@ -453,6 +1223,7 @@ int main(int argc, char *argv[])
             printf(" Content-Type: %s%s", POST_MIME_MULTIFORM, bench_params.post.boundary);
     }
 
+version:
     switch(bench_params.http_version) {
     case 0:
         printf(" (using HTTP/0.9)");
@@ -467,6 +1238,23 @@ int main(int argc, char *argv[])
         goto failed;
     }
 
+    if (bench_params.keepalive && bench_params.force) {
+        fprintf(stderr, "Error in option -k|--keepalive: can not be used with -f|--force.\n");
+        goto failed;
+    }
+
+    if (bench_params.pipeline > 1 && bench_params.post.in_file) {
+        fprintf(stderr, "Error in option --pipeline: can not be used with -i|--file.\n");
+        goto failed;
+    }
+
+    /* agents decide by their own kernels */
+    if (bench_params.engine == ENGINE_URING && bench_params.coordinator == NULL
+        && (missing = uring_missing()) != NULL) {
+        fprintf(stderr, "Warning in option --engine uring: %s, falls back to epoll.\n", missing);
+        bench_params.engine = ENGINE_EPOLL;
+    }
+
     printf("\n");
     if (bench_params.clients == 1)
         printf("1 client");
@@ -475,9 +1263,32 @@ int main(int argc, char *argv[])
 
     printf(", running %d sec", bench_params.benchtime);
 
+    if (bench_params.engine != ENGINE_FORK && bench_params.workers <= 0)
+        printf(", %s engine", engine_names[bench_params.engine]);
+    else if (bench_params.engine != ENGINE_FORK)
+        printf(", %s engine with %d worker%s", engine_names[bench_params.engine], bench_params.workers,
+            bench_params.workers == 1 ? "" : "s");
+
+    if (bench_params.coordinator != NULL)
+        printf(", on agents %s", bench_params.coordinator);
+
     if (bench_params.force)
         printf(", early socket close");
 
+    if (bench_params.keepalive)
+        printf(", keep-alive");
+
+    if (bench_params.pipeline > 1)
+        printf(", pipeline %d", bench_params.pipeline);
+
+    if (nstages)
+        printf(", ramp %s", bench_params.ramp);
+    else if (bench_params.rate > 0)
+        printf(", %g requests/sec", bench_params.rate);
+
+    if (bench_params.pin)
+        printf(", pinned to %d CPU%s", CPU_COUNT(&cpuset), CPU_COUNT(&cpuset) == 1 ? "" : "s");
+
     if (bench_params.proxy.proxyhost != NULL)
         printf(", via proxy server %s:%d", bench_params.proxy.proxyhost, bench_params.proxy.proxyport);
 
@@ -491,134 +1302,251 @@ int main(int argc, char *argv[])
 
     printf(".\n");
 
-    return bench();
+    if (bench_params.urls == NULL
+        && !build_special_request(&requests[0], NULL, bench_params.post.post ? bench_params.post.content : NULL))
+        goto failed;
+
+    i = bench_params.coordinator ? coordinate() : bench();
+
+    /* --output has written them */
+    free_header();
+
+    return i;
 
 failed:
     free_header();
     free_boundary();
+    if (output_file)
+        fclose(output_file);
 
     return 2;
 }
 
-static int build_special_request(void)
+/*
+ * Compile the placeholders of part of req, 0 the head and 1 the body,
+ * into its fields: each one is replaced by zeros as wide as its values.
+ * Returns 0 if one is malformed.
+ */
+static int request_compile(request_t *req, int part)
 {
-    int i;
-    long cl;
-    char str[64];
-    header_t *header = &bench_params.header;
+    strbuf_t *b = part ? &req->body : &req->head, text = { NULL, 0, 0 };
+    const char *p, *at;
+    field_t f, *fields;
+    int n;
+
+    if (b->data == NULL || strstr(b->data, "{{") == NULL)
+        return 1;
+
+    for (p = b->data; (at = strstr(p, "{{")) != NULL; p = at + n) {
+        strbuf_append(&text, p, at - p);
+        n = field_parse(at, &f);
+        if (n < 0) {
+            fprintf(stderr, "Error in placeholder %.*s: Invalid range.\n", (int) strcspn(at, "}") + 2, at);
+            free(text.data);
+            return 0;
+        }
+
+        /* not one of ours, as it is */
+        if (n == 0) {
+            strbuf_append(&text, at, 1);
+            n = 1;
+            continue;
+        }
+
+        fields = (field_t *)realloc(req->fields, (req->nfields + 1) * sizeof(field_t));
+        if (fields == NULL) {
+            fprintf(stderr, "Error in alloc for request.\n");
+            free(text.data);
+            return 0;
+        }
+
+        f.part = part;
+        f.off = text.len;
+        req->fields = fields;
+        req->fields[req->nfields++] = f;
+        while (f.width--)
+            strbuf_append(&text, "0", 1);
+    }
+
+    strbuf_cat(&text, p);
+    free(b->data);
+    *b = text;
+
+    return 1;
+}
+
+/*
+ * Completes the request started by build_request(): custom headers, the
+ * extra ones of a --urls entry, Content-Length and the body, content or
+ * with --file the file it names. After this the request is only read.
+ *
+ * The file is mapped here, before the workers start: processes and
+ * threads all send from the same read-only pages, with no descriptor or
+ * buffer of their own.
+ */
+static int build_special_request(request_t *req, const header_t *extra, const char *content)
+{
+    int i, j, fd;
+    struct stat st;
+    const header_t *header = &bench_params.header;
+
+    /* HTTP/0.9 has no headers */
+    if (bench_params.http_version == 0)
+        goto done;
 
     if (header->key) {
         for (i = 0; i < header->count; i++)
-            sprintf(request + strlen(request), "%s: %s\r\n", header->key[i], header->value[i]);
+            strbuf_printf(&req->head, "%s: %s\r\n", header->key[i], header->value[i]);
     }
 
-    if (bench_params.post.post) {
+    if (extra) {
+        for (i = 0; i < extra->count; i++)
+            strbuf_printf(&req->head, "%s: %s\r\n", extra->key[i], extra->value[i]);
+    }
+
+    if (content) {
         if (!bench_params.post.in_file)
-            sprintf(request + strlen(request), "Content-Length: %ld\r\n", strlen(bench_params.post.content));
+            strbuf_cat(&req->body, content);
         else {
-            sprintf(request + strlen(request), "Content-Type: %s%s\r\n", POST_MIME_MULTIFORM, bench_params.post.boundary);
-
-            fseek(bench_params.post.file, 0L, SEEK_END);
-
-            cl = 2 + BOUNDARY_SIZE + strlen("\r\n") /* first boundary */
-                + strlen(POST_CONTENT_DISPOSITION)
-                + strlen(POST_CONTENT_DISPOSITION_FILENAME_START)
-                + strlen(bench_params.post.content)
-                + strlen(POST_CONTENT_DISPOSITION_FILENAME_END)
-                + strlen("\r\n") /* Content-Disposition */
-                + strlen(POST_CONTENT_DISPOSITION_CONTENT_TYPE)
-                + strlen("\r\n\r\n") /* Content-Type in Content-Disposition */
-                + ftell(bench_params.post.file) /* file length */
-                + strlen("\r\n")
-                + 2 + BOUNDARY_SIZE
-                + strlen("--\r\n"); /* last boundary */
-
-            bzero(str, 64);
-            sprintf(str, "%ld", cl);
-
-            if (strlen(request) + strlen("Content-Length: \r\n") + strlen(str) >= REQUEST_SIZE) {
-                fprintf(stderr, "Error in request size: %ld, overflowed.\n",
-                    strlen(request) + strlen("Content-Lenght: \r\n") + strlen(str));
+            fd = open(content, O_RDONLY | O_CLOEXEC);
+            if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+                fprintf(stderr, "Error in file open: %s.\n", content);
+                if (fd >= 0)
+                    close(fd);
 
-                free_header();
-                free_boundary();
                 return 0;
             }
 
-            sprintf(request + strlen(request), "Content-Length: %ld\r\n", cl);
-            fseek(bench_params.post.file, 0L, SEEK_SET);
+            /* an empty file has nothing to map */
+            if (st.st_size > 0) {
+                req->file = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+                if (req->file == MAP_FAILED) {
+                    fprintf(stderr, "Error in file map: %s: %s.\n", content, strerror(errno));
+                    close(fd);
+                    return 0;
+                }
+            }
+
+            close(fd);
+
+            strbuf_printf(&req->head, "Content-Type: %s%s\r\n", POST_MIME_MULTIFORM, bench_params.post.boundary);
+
+            /* --boundary\r\nContent-Disposition...\r\nContent-Type...\r\n\r\n */
+            strbuf_cat(&req->body, "--");
+            strbuf_cat(&req->body, bench_params.post.boundary);
+            strbuf_cat(&req->body, "\r\n");
+            strbuf_cat(&req->body, POST_CONTENT_DISPOSITION);
+            strbuf_cat(&req->body, POST_CONTENT_DISPOSITION_FILENAME_START);
+            strbuf_cat(&req->body, content);
+            strbuf_cat(&req->body, POST_CONTENT_DISPOSITION_FILENAME_END);
+            strbuf_cat(&req->body, "\r\n");
+            strbuf_cat(&req->body, POST_CONTENT_DISPOSITION_CONTENT_TYPE);
+            strbuf_cat(&req->body, "\r\n\r\n");
+
+            /* content, then \r\n--boundary--\r\n */
+            req->file_len = st.st_size;
+            strbuf_printf(&req->trailer, "\r\n--%s--\r\n", bench_params.post.boundary);
         }
 
-        strcat(request, "\r\n");
-        if (!bench_params.post.in_file)
-            memcpy(request + strlen(request), bench_params.post.content, strlen(bench_params.post.content));
-        else {
-            strcat(request, "--");
-            strcat(request, bench_params.post.boundary);
-            strcat(request, "\r\n");
-            strcat(request, POST_CONTENT_DISPOSITION);
-            strcat(request, POST_CONTENT_DISPOSITION_FILENAME_START);
-            strcat(request, bench_params.post.content);
-            strcat(request, POST_CONTENT_DISPOSITION_FILENAME_END);
-            strcat(request, "\r\n");
-            strcat(request, POST_CONTENT_DISPOSITION_CONTENT_TYPE);
-            strcat(request, "\r\n\r\n");
-            /* content\r\n--boundary--\r\n */
+        /* fields keep the length of the body */
+        if (!request_compile(req, 1))
+            return 0;
+
+        strbuf_printf(&req->head, "Content-Length: %lu\r\n",
+            (unsigned long) (req->body.len + req->file_len + req->trailer.len));
+    }
+
+    /* add empty line at end */
+    strbuf_cat(&req->head, "\r\n");
+
+done:
+    if (!request_compile(req, 0))
+        return 0;
+
+    req->iov[0].iov_base = req->head.data;
+    req->iov[0].iov_len = req->head.len;
+    req->iov[1].iov_base = req->body.data;
+    req->iov[1].iov_len = req->body.len;
+    req->iov[2].iov_base = (void *) req->file;
+    req->iov[2].iov_len = req->file_len;
+    req->iov[3].iov_base = req->trailer.data;
+    req->iov[3].iov_len = req->trailer.len;
+    req->len = req->head.len + req->body.len + req->file_len + req->trailer.len;
+
+    /* the pipelined copies all point at the same request */
+    req->piov = (struct iovec *)malloc(REQUEST_IOVS * bench_params.pipeline * sizeof(struct iovec));
+    if (req->piov == NULL) {
+        fprintf(stderr, "Error in alloc for request.\n");
+        return 0;
+    }
+
+    for (i = 0; i < bench_params.pipeline; i++) {
+        for (j = 0; j < REQUEST_IOVS; j++) {
+            if (req->iov[j].iov_len)
+                req->piov[req->npiov++] = req->iov[j];
         }
     }
 
-    free_header();
     return 1;
 }
 
-void build_request(const char *url)
+/* raise the HTTP version to what method and the options need */
+static void request_version(int method)
 {
-    char tmp[10];
-    int i;
-
-    bzero(host, MAXHOSTNAMELEN);
-    bzero(request, REQUEST_SIZE);
- 
     if (bench_params.force_reload && bench_params.proxy.proxyhost != NULL && bench_params.http_version < 1)
         bench_params.http_version = 1;
 
-    if (bench_params.method == METHOD_HEAD && bench_params.http_version < 1)
+    if (method == METHOD_HEAD && bench_params.http_version < 1)
         bench_params.http_version = 1;
 
-    if (bench_params.method == METHOD_OPTIONS && bench_params.http_version < 2)
+    if (method == METHOD_OPTIONS && bench_params.http_version < 2)
+        bench_params.http_version = 2;
+
+    if (method == METHOD_TRACE && bench_params.http_version < 2)
         bench_params.http_version = 2;
 
-    if (bench_params.method == METHOD_TRACE && bench_params.http_version < 2)
+    if (bench_params.keepalive && bench_params.http_version < 2)
         bench_params.http_version = 2;
 
-    if (bench_params.method == METHOD_POST && bench_params.http_version < 2) {
+    if (method == METHOD_POST && bench_params.http_version < 2) {
         /* rfc1867 was published in 1995, http 1.0 was published in 1982. */
         if (bench_params.post.in_file)
             bench_params.http_version = 2;
-        else
+        else if (bench_params.http_version < 1)
             bench_params.http_version = 1;
     }
+}
+
+/* request line and standard headers of req->method url, sets host and port */
+void build_request(request_t *req, const char *url)
+{
+    char tmp[10];
+    int i;
+    size_t len = 0;
+    const char *authority = NULL, *p;
+
+    bzero(host, MAXHOSTNAMELEN);
 
-    switch (bench_params.method) {
+    switch (req->method) {
     default:
     case METHOD_GET:
-        strcpy(request, "GET");
+        strbuf_cat(&req->head, "GET");
         break;
     case METHOD_HEAD:
-        strcpy(request, "HEAD");
+        strbuf_cat(&req->head, "HEAD");
         break;
     case METHOD_OPTIONS:
-        strcpy(request, "OPTIONS");
+        strbuf_cat(&req->head, "OPTIONS");
         break;
     case METHOD_TRACE:
-        strcpy(request, "TRACE");
+        strbuf_cat(&req->head, "TRACE");
         break;
     case METHOD_POST:
-        strcpy(request, "POST");
+        strbuf_cat(&req->head, "POST");
         break;
     }
 
-    strcat(request, " ");
+    strbuf_cat(&req->head, " ");
 
     if (NULL == strstr(url, "://")) {
         fprintf(stderr, "\n%s: is not a valid URL.\n", url);
@@ -630,11 +1558,16 @@ void build_request(const char *url)
         exit(2);
     }
 
+    bench_params.tls = strncasecmp("https://", url, 8) == 0;
     if (bench_params.proxy.proxyhost == NULL) {
-        if (0 != strncasecmp("http://", url, 7)) {
-            fprintf(stderr, "\nOnly HTTP protocol is directly supported, set --proxy for others.\n");
+        if (0 != strncasecmp("http://", url, 7) && !bench_params.tls) {
+            fprintf(stderr, "\nOnly HTTP and HTTPS protocols are directly supported, set --proxy for others.\n");
             exit(2);
         }
+    } else if (bench_params.tls) {
+        /* that takes a CONNECT tunnel */
+        fprintf(stderr, "\nHTTPS is not supported through --proxy.\n");
+        exit(2);
     }
 
     /* protocol/host delimiter */
@@ -646,83 +1579,301 @@ void build_request(const char *url)
         exit(2);
     }
 
+    if (bench_params.proxy.proxyhost == NULL && strcspn(url + i, "/") >= MAXHOSTNAMELEN) {
+        fprintf(stderr, "\nHostname is too long.\n");
+        exit(2);
+    }
+
     if (bench_params.proxy.proxyhost == NULL) {
+        /* host[:port], or [address][:port] for IPv6 */
+        authority = url + i;
+        len = strcspn(authority, "/");
+        if (*authority == '[') {
+            p = memchr(authority, ']', len);
+            if (p == NULL) {
+                fprintf(stderr, "\nInvalid URL syntax - IPv6 address don't ends with ']'.\n");
+                exit(2);
+            }
+
+            strncpy(host, authority + 1, p - authority - 1);
+            p++;
+        } else {
+            p = memchr(authority, ':', len);
+            if (p == NULL)
+                p = authority + len;
+
+            strncpy(host, authority, p - authority);
+        }
+
         /* get port from hostname */
-        if (index(url + i, ':') != NULL
-            && index(url + i, ':') < index(url + i, '/')
-        )
-        {
-            strncpy(host, url + i, strchr(url + i, ':') - url - i);
+        if (*p == ':') {
             bzero(tmp, 10);
-            strncpy(tmp, index(url + i, ':') + 1, strchr(url + i, '/') - index(url + i, ':') - 1);
+            strncpy(tmp, p + 1, MIN(authority + len - p - 1, 9));
             /* printf("tmp = %s\n", tmp); */
             bench_params.proxy.proxyport = atoi(tmp);
             if (bench_params.proxy.proxyport == 0)
-                bench_params.proxy.proxyport = 80;
+                bench_params.proxy.proxyport = bench_params.tls ? 443 : 80;
         } else
-            strncpy(host, url + i, strcspn(url + i, "/"));
+            bench_params.proxy.proxyport = bench_params.tls ? 443 : 80;
 
         // printf("Host = %s\n", host);
-        strcat(request + strlen(request), url + i + strcspn(url + i, "/"));
+        strbuf_cat(&req->head, url + i + strcspn(url + i, "/"));
     } else {
         // printf("ProxyHost = %s\nProxyPort = %d\n",
         // bench_params.proxy.proxyhost, bench_params.proxy.proxyport);
-        strcat(request, url);
+        strbuf_cat(&req->head, url);
     }
 
     if (bench_params.http_version == 1)
-        strcat(request, " HTTP/1.0");
+        strbuf_cat(&req->head, " HTTP/1.0");
     else if (bench_params.http_version == 2)
-        strcat(request, " HTTP/1.1");
+        strbuf_cat(&req->head, " HTTP/1.1");
 
-    strcat(request, "\r\n");
+    strbuf_cat(&req->head, "\r\n");
     if (bench_params.http_version > 0)
-        strcat(request, "User-Agent: WebBench "PROGRAM_VERSION"\r\n");
+        strbuf_cat(&req->head, "User-Agent: WebBench "PROGRAM_VERSION"\r\n");
 
+    /* as in the URL, with the port and brackets if there are */
     if (bench_params.proxy.proxyhost == NULL && bench_params.http_version > 0) {
-        strcat(request, "Host: ");
-        strcat(request, host);
-        strcat(request, "\r\n");
+        strbuf_cat(&req->head, "Host: ");
+        strbuf_append(&req->head, authority, len);
+        strbuf_cat(&req->head, "\r\n");
     }
 
     if (bench_params.force_reload && bench_params.proxy.proxyhost != NULL)
-        strcat(request, "Pragma: no-cache\r\n");
+        strbuf_cat(&req->head, "Pragma: no-cache\r\n");
 
-    if (bench_params.http_version > 1)
-        strcat(request, "Connection: close\r\n");
+    if (bench_params.http_version > 1 && !bench_params.keepalive)
+        strbuf_cat(&req->head, "Connection: close\r\n");
+    // printf("Req = %s\n", req->head.data);
+}
 
-    /* add empty line at end */
-    if (bench_params.http_version > 0 && !bench_params.post.post)
-        strcat(request, "\r\n");
-    // printf("Req = %s\n", request);
+static const char *method_names[] = {
+    "GET", "HEAD", "OPTIONS", "TRACE", "POST"
+};
+
+/*
+ * --urls: builds a request for every line of file, in the form
+ *
+ *   weight method url [-d header:value]... [-o content]
+ *
+ * and the table to draw them by weight. All URLs must be on the same
+ * server, as kept alive connections go on with whatever entry is next.
+ */
+static int load_urls(const char *file)
+{
+    FILE *f;
+    char *line = NULL, *word[SCENARIO_MAX_WORDS], *p;
+    char *key[SCENARIO_MAX_WORDS / 2], *value[SCENARIO_MAX_WORDS / 2];
+    char first[MAXHOSTNAMELEN];
+    size_t size = 0;
+    int pass, lineno, n, i, k, count = 0, method, port = 0, tls = 0, rc = 0;
+    const char *content;
+    double weight, *weights = NULL;
+    header_t header;
+    request_t *req;
+
+    f = fopen(file, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Error in option --urls %s: Can not open file.\n", file);
+        return 0;
+    }
+
+    header.key = key;
+    header.value = value;
+
+    /* the first pass checks the lines and finds the HTTP version for all */
+    for (pass = 0; pass < 2; pass++) {
+        rewind(f);
+        lineno = 0;
+        k = 0;
+
+        while (getline(&line, &size, f) >= 0) {
+            lineno++;
+            n = scenario_split(line, word);
+            if (n == 0)
+                continue;
+
+            if (n < 3) {
+                fprintf(stderr, "Error in option --urls %s: Line %d: Bad format.\n", file, lineno);
+                goto done;
+            }
+
+            weight = atof(word[0]);
+            if (weight <= 0) {
+                fprintf(stderr, "Error in option --urls %s: Line %d: Weight must be greater than 0.\n", file, lineno);
+                goto done;
+            }
+
+            for (method = 0; method <= METHOD_POST; method++) {
+                if (strcasecmp(word[1], method_names[method]) == 0)
+                    break;
+            }
+
+            if (method > METHOD_POST) {
+                fprintf(stderr, "Error in option --urls %s: Line %d: Unknown method %s.\n", file, lineno, word[1]);
+                goto done;
+            }
+
+            header.count = 0;
+            content = NULL;
+            for (i = 3; i < n; i += 2) {
+                if (i + 1 == n) {
+                    fprintf(stderr, "Error in option --urls %s: Line %d: Missing value of %s.\n", file, lineno, word[i]);
+                    goto done;
+                }
+
+                if (strcmp(word[i], "-d") == 0 || strcmp(word[i], "--header") == 0) {
+                    p = strchr(word[i + 1], ':');
+                    if (p == NULL || p == word[i + 1]) {
+                        fprintf(stderr, "Error in option --urls %s: Line %d: Bad header %s.\n", file, lineno, word[i + 1]);
+                        goto done;
+                    }
+
+                    *p = '\0';
+                    while (*(++p) == ' ') { /* void */ }
+                    header.key[header.count] = word[i + 1];
+                    header.value[header.count++] = p;
+                } else if (strcmp(word[i], "-o") == 0 || strcmp(word[i], "--post") == 0) {
+                    content = word[i + 1];
+                } else {
+                    fprintf(stderr, "Error in option --urls %s: Line %d: Unknown option %s.\n", file, lineno, word[i]);
+                    goto done;
+                }
+            }
+
+            if (content != NULL && method != METHOD_POST) {
+                fprintf(stderr, "Error in option --urls %s: Line %d: Only POST has content.\n", file, lineno);
+                goto done;
+            }
+
+            if (pass == 0) {
+                request_version(method);
+                count++;
+                continue;
+            }
+
+            req = &requests[k];
+            req->method = method;
+            req->url = strdup(word[2]);
+            weights[k] = weight;
+            if (req->url == NULL) {
+                fprintf(stderr, "Error in alloc for request.\n");
+                goto done;
+            }
+
+            build_request(req, word[2]);
+            if (k == 0) {
+                strcpy(first, host);
+                port = bench_params.proxy.proxyport;
+                tls = bench_params.tls;
+            } else if (bench_params.proxy.proxyhost == NULL
+                && (strcmp(first, host) != 0 || port != bench_params.proxy.proxyport || tls != bench_params.tls)) {
+                fprintf(stderr, "Error in option --urls %s: Line %d: All URLs must be on %s://%s:%d.\n",
+                    file, lineno, tls ? "https" : "http", first, port);
+                goto done;
+            }
+
+            if (content != NULL) {
+                for (i = 0; i < header.count; i++) {
+                    if (strcasecmp(header.key[i], "Content-Type") == 0)
+                        break;
+                }
+
+                if (i == header.count) {
+                    header.key[header.count] = "Content-Type";
+                    header.value[header.count++] = (char *)POST_MIME_URLENCODED;
+                }
+            }
+
+            if (!build_special_request(req, &header, content))
+                goto done;
+
+            k++;
+        }
+
+        if (count == 0) {
+            fprintf(stderr, "Error in option --urls %s: No URLs.\n", file);
+            goto done;
+        }
+
+        if (pass == 0) {
+            requests = (request_t *)calloc(count, sizeof(request_t));
+            weights = (double *)malloc(count * sizeof(double));
+            if (requests == NULL || weights == NULL) {
+                fprintf(stderr, "Error in alloc for request.\n");
+                goto done;
+            }
+        }
+    }
+
+    nrequests = count;
+    if (!alias_init(&picker, weights, count)) {
+        fprintf(stderr, "Error in alloc for request.\n");
+        goto done;
+    }
+
+    rc = 1;
+
+done:
+    free(weights);
+    free(line);
+    fclose(f);
+
+    return rc;
 }
 
 /* vraci system rc error kod */
 static int bench(void)
 {
-    int i, j, k;
+    int i, at, procs, nprocs, died = 0, status, rc = 0, nconns = 1;
     pid_t pid = 0;
-    FILE *f;
-
-    /* check avaibility of target server */
-    i = Socket(
-        bench_params.proxy.proxyhost == NULL ? host : bench_params.proxy.proxyhost,
-        bench_params.proxy.proxyport
-    );
-
-    if (i < 0) {
-        fprintf(stderr, "\nConnect to server failed. Aborting benchmark.\n");
+    histogram_t total, handshakes[2], phases[PHASES];
+    sampler_t sampler;
+    struct addrinfo *ai;
+
+    /* resolve once, workers share the addresses */
+    resolved = Resolve(bench_params.proxy.proxyhost == NULL ? host : bench_params.proxy.proxyhost,
+        bench_params.proxy.proxyport);
+    if (resolved == NULL) {
+        fprintf(stderr, "\nUnknown host %s. Aborting benchmark.\n",
+            bench_params.proxy.proxyhost == NULL ? host : bench_params.proxy.proxyhost);
         return 1;
     }
 
-    close(i);
+    for (ai = resolved, i = 0; ai != NULL; ai = ai->ai_next)
+        i++;
 
-    /* create pipe */
-    if (pipe(mypipe)) {
-        perror("pipe failed.");
+    targets = (target_t *)calloc(i, sizeof(target_t));
+    if (targets == NULL) {
+        fprintf(stderr, "Error in alloc for addresses.\n");
         return 3;
     }
 
+    /* check avaibility of target server, at each address */
+    for (ai = resolved, at = 0; ai != NULL; ai = ai->ai_next, at++) {
+        AddrName(ai, targets[ntargets].name, sizeof(targets[ntargets].name));
+        i = AddrSocket(ai, bench_params.connect_timeout > 0);
+        if (i >= 0 && bench_params.connect_timeout && !AddrConnected(i, bench_params.connect_timeout)) {
+            close(i);
+            i = -1;
+        }
+
+        if (i < 0) {
+            fprintf(stderr, "Warning: connect to %s failed, not used.\n", targets[ntargets].name);
+            continue;
+        }
+
+        close(i);
+        targets[ntargets].at = at;
+        targets[ntargets++].ai = ai;
+    }
+
+    if (ntargets == 0) {
+        fprintf(stderr, "\nConnect to server failed. Aborting benchmark.\n");
+        return 1;
+    }
+
     /* not needed, since we have alarm() in childrens */
     /* wait 4 next system clock tick */
     /*
@@ -731,12 +1882,90 @@ static int bench(void)
         sched_yield();
     */
 
+    /* the epoll and thread engines run all clients in a few workers */
+    if (bench_params.engine == ENGINE_FORK)
+        procs = bench_params.clients;
+    else
+        procs = bench_params.workers;
+
+    nprocs = procs;
+
+    /*
+     * Every worker counts into a slot of its own that the parent reads
+     * while it runs, and still can when the worker dies.
+     */
+    shards = (shard_t *)mmap(NULL, nprocs * sizeof(shard_t), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shards == MAP_FAILED) {
+        perror("mmap failed.");
+        return 3;
+    }
+
+    /* before the workers start, they all share it */
+    if (bench_params.tls) {
+        tls_ctx = tls_context(bench_params.tls_reuse ? tls_new_session : NULL);
+        if (tls_ctx == NULL) {
+            fprintf(stderr, "Error in TLS setup.\n");
+            rc = 3;
+            goto done;
+        }
+    }
+
+    if (bench_params.urls != NULL) {
+        entry_stats = (entry_stats_t *)mmap(NULL, nprocs * nrequests * sizeof(entry_stats_t),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (entry_stats == MAP_FAILED) {
+            perror("mmap failed.");
+            return 3;
+        }
+    }
+
+    if (ntargets > 1) {
+        target_stats = (entry_stats_t *)mmap(NULL, nprocs * ntargets * sizeof(entry_stats_t),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (target_stats == MAP_FAILED) {
+            perror("mmap failed.");
+            return 3;
+        }
+    }
+
+    if (nstages) {
+        stage_stats = (entry_stats_t *)mmap(NULL, nprocs * nstages * sizeof(entry_stats_t),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (stage_stats == MAP_FAILED) {
+            perror("mmap failed.");
+            return 3;
+        }
+    }
+
+    /* an agent starts when the coordinator says so, with the others */
+    if (agent_fd >= 0 && agent_start()) {
+        fprintf(stderr, "\nCoordinator gone. Aborting benchmark.\n");
+        rc = 1;
+        goto done;
+    }
+
+    if (bench_params.engine == ENGINE_THREAD) {
+        rc = bench_threads(bench_params.proxy.proxyhost == NULL ? host : bench_params.proxy.proxyhost,
+            bench_params.proxy.proxyport);
+        goto done;
+    }
+
+    /* or the childs print it again when they exit */
+    fflush(stdout);
+
+    /* the childs start after their sleep(1), the --ramp stages with them */
+    run_start = now_usec() + 1000000;
+
     /* fork childs */
-    for (i = 0; i < bench_params.clients; i++) {
+    for (i = 0; i < procs; i++) {
         pid = fork();
 
         if (pid <= (pid_t) 0) {
             /* child process or error*/
+            if (pid == (pid_t) 0)
+                worker_place(i);
+
             sleep(1); /* make childs faster */
             break;
         }
@@ -750,264 +1979,2890 @@ static int bench(void)
 
     if (pid == (pid_t) 0) {
         /* I am a child */
-        do {
-            if (bench_params.post.post && bench_params.post.in_file) {
-                bench_params.post.file = fopen(bench_params.post.content, "r");
-                if (bench_params.post.file == NULL) {
-                    fprintf(stderr, "Error in file open: %s.\n", bench_params.post.content);
-                    break;
-                }
-            }
+        shard = &shards[i];
+        if (entry_stats)
+            entry_stat = &entry_stats[i * nrequests];
+
+        if (target_stats)
+            target_stat = &target_stats[i * ntargets];
+
+        if (stage_stats)
+            stage_stat = &stage_stats[i * nstages];
+
+        /* spread the clients evenly among the workers */
+        nconns = bench_params.clients / procs + (i < bench_params.clients % procs);
+        if (bench_params.engine == ENGINE_EPOLL)
+            benchcore_epoll(bench_params.proxy.proxyhost == NULL ? host : bench_params.proxy.proxyhost,
+                bench_params.proxy.proxyport, requests, nconns, i);
+        else if (bench_params.engine == ENGINE_URING)
+            benchcore_uring(bench_params.proxy.proxyhost == NULL ? host : bench_params.proxy.proxyhost,
+                bench_params.proxy.proxyport, requests, nconns, i);
+        else if (bench_params.proxy.proxyhost == NULL)
+            benchcore(host, bench_params.proxy.proxyport, requests, i);
+        else
+            benchcore(bench_params.proxy.proxyhost, bench_params.proxy.proxyport, requests, i);
 
-            if (build_special_request()) {
-                if (bench_params.proxy.proxyhost == NULL)
-                    benchcore(host, bench_params.proxy.proxyport, request);
-                else
-                    benchcore(bench_params.proxy.proxyhost, bench_params.proxy.proxyport, request);
-            }
-        } while (0);
+        /* the counts are in the shard already */
+        return 0;
+    }
 
-        /* write results to pipe */
-        f = fdopen(mypipe[1], "w");
-        if (f == NULL) {
-            perror("open pipe for writing failed.");
-            return 3;
-        }
+    /* parent */
+    free_boundary();
 
-        /* fprintf(stderr, "Child - %d %d\n", succeeded, failed); */
-        fprintf(f, "%d %d %ld\n", statistics.succeeded, statistics.failed, statistics.bytes);
-        fclose(f);
-        return 0;
-    } else {
-        if (i == bench_params.clients) {
-            free_header();
-            free_boundary();
-        }
+    sampler_init(&sampler, run_start);
 
-        /* parent */
-        f = fdopen(mypipe[0], "r");
-        if (f == NULL) {
-            perror("open pipe for reading failed.");
-            return 3;
+    while (procs > 0) {
+        if (sampler_wait(&sampler) == 0) {
+            sampler_sample(&sampler, nprocs);
+            pid = waitpid(-1, &status, WNOHANG);
+        } else
+            pid = waitpid(-1, &status, 0);
+
+        for ( ; pid > 0; pid = waitpid(-1, &status, WNOHANG)) {
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                died++;
+
+            procs--;
         }
 
-        setvbuf(f, NULL, _IONBF, 0);
-        statistics.succeeded = 0;
-        statistics.failed = 0;
-        statistics.bytes = 0;
+        if (pid < 0 && errno != EINTR)
+            break;
+    }
+
+    if (died)
+        fprintf(stderr, "Some of our childrens died.\n");
 
-        for ( ;; ) {
-            pid = fscanf(f, "%d %d %d", &i, &j, &k);
-            if (pid < 2) {
-                fprintf(stderr, "Some of our childrens died.\n");
-                break;
-            }
+    shards_sum(&statistics, nprocs);
+    shards_merge(&total, handshakes, phases, nprocs);
+    if (stage_stats)
+        stages_sum(stage_stats, nprocs);
 
-            statistics.succeeded += i;
-            statistics.failed += j;
-            statistics.bytes += k;
-            /* fprintf(stderr, "*Knock* %d %d read = %d\n", succeeded, failed, pid); */
-            if (--bench_params.clients == 0)
-                break;
-        }
+    if (agent_fd >= 0)
+        agent_done(&total, handshakes, phases);
+
+    report(&total, handshakes, phases);
+    report_stages();
+    if (bench_params.output)
+        rc = write_output(&total, handshakes, phases, &sampler);
+
+    sampler_free(&sampler);
 
-        fclose(f);
+done:
+    if (entry_stats) {
+        if (rc == 0)
+            report_details(entry_stats, nprocs, nrequests, "request");
 
-        printf("\nsucceeded = %d pages/min, %ld bytes/sec.\nRequests: %d successful, %d failed.\n",
-            (int) ((statistics.succeeded + statistics.failed) / (bench_params.benchtime / 60.0f)),
-            (long) (statistics.bytes / (float) bench_params.benchtime),
-            statistics.succeeded,
-            statistics.failed);
+        munmap(entry_stats, nprocs * nrequests * sizeof(entry_stats_t));
     }
 
-    return i;
-}
+    if (target_stats) {
+        if (rc == 0)
+            report_details(target_stats, nprocs, ntargets, "address");
 
-static void close_post_file(void)
-{
-    if (bench_params.post.file) {
-        fclose(bench_params.post.file);
-        bench_params.post.file = NULL;
+        munmap(target_stats, nprocs * ntargets * sizeof(entry_stats_t));
     }
+
+    if (stage_stats)
+        munmap(stage_stats, nprocs * nstages * sizeof(entry_stats_t));
+
+    munmap(shards, nprocs * sizeof(shard_t));
+    if (tls_ctx)
+        SSL_CTX_free(tls_ctx);
+
+    free(targets);
+    freeaddrinfo(resolved);
+
+    return rc;
 }
 
-void benchcore(const char *host, const int port, char *req)
+static void report(const histogram_t *h, const histogram_t *handshakes, const histogram_t *phases)
 {
-    int rlen;
-    char buf[MAX_BUF_SIZE];
-    char multipart_initial[REQUEST_SIZE];
-    int s = 0, i;
-    struct sigaction sa;
-    size_t r;
-    int multipart_first = 0, eof = 0, reread = 0;
+    int i;
 
-    /* setup alarm signal handler */
-    sa.sa_handler = alarm_handler;
-    sa.sa_flags = 0;
+    printf("\nsucceeded = %d pages/min, %ld bytes/sec.\nRequests: %d successful, %d failed",
+        (int) ((statistics.succeeded + statistics.failed) / (bench_params.benchtime / 60.0f)),
+        (long) (statistics.bytes / (float) bench_params.benchtime),
+        statistics.succeeded,
+        statistics.failed);
 
-    if (sigaction(SIGALRM, &sa, NULL))
-        exit(3);
+    if (statistics.timedout)
+        printf(", %d of them timed out", statistics.timedout);
 
-    alarm(bench_params.benchtime);
+    printf(".\n");
 
-    rlen = strlen(req);
+    if (h->total == 0)
+        return;
 
-    if (bench_params.post.in_file) {
-        /* for retry */
-        bzero(multipart_initial, REQUEST_SIZE);
-        memcpy(multipart_initial, req, rlen);
+    printf("Latency (ms): p50 = %.3f, p90 = %.3f, p99 = %.3f, p99.9 = %.3f, max = %.3f.\n",
+        histogram_percentile(h, 50.0) / 1000.0,
+        histogram_percentile(h, 90.0) / 1000.0,
+        histogram_percentile(h, 99.0) / 1000.0,
+        histogram_percentile(h, 99.9) / 1000.0,
+        h->max / 1000.0);
+
+    /* apart from the requests, whose latency they are part of */
+    for (i = 0; i < 2; i++) {
+        if (handshakes[i].total == 0)
+            continue;
+
+        printf("TLS %s handshakes: %llu, p50 = %.3f, p99 = %.3f, max = %.3f ms.\n",
+            i ? "resumed" : "full", handshakes[i].total,
+            histogram_percentile(&handshakes[i], 50.0) / 1000.0,
+            histogram_percentile(&handshakes[i], 99.0) / 1000.0,
+            handshakes[i].max / 1000.0);
     }
 
-nexttry:
-    for ( ;; ) {
-        if (timerexpired) {
-            if (statistics.failed > 0) {
-                /* fprintf(stderr, "Correcting failed by signal\n"); */
-                statistics.failed--;
-            }
+    /* where the time of the requests went */
+    printf("Phases (ms):      count       p50       p90       p99       max\n");
+    for (i = 0; i < PHASES; i++) {
+        if (phases[i].total == 0)
+            continue;
 
-            close_post_file();
-            return;
-        }
+        printf("  %-9s %11llu %9.3f %9.3f %9.3f %9.3f\n", phase_names[i], phases[i].total,
+            histogram_percentile(&phases[i], 50.0) / 1000.0,
+            histogram_percentile(&phases[i], 90.0) / 1000.0,
+            histogram_percentile(&phases[i], 99.0) / 1000.0,
+            phases[i].max / 1000.0);
+    }
 
-        if (!multipart_first) {
-            s = Socket(host, port);
-            if (s < 0) {
-                statistics.failed++;
-                continue;
-            }
+    /* HTTP/0.9 and --force have no status to count */
+    if (bench_params.http_version == 0 || bench_params.force)
+        return;
 
-            if (bench_params.post.in_file)
-                multipart_first = 1;
-        }
+    printf("Status: 2xx = %d, 3xx = %d, 4xx = %d, 5xx = %d",
+        statistics.status[2], statistics.status[3], statistics.status[4], statistics.status[5]);
 
-        if (rlen != write(s, req, rlen)) {
-            statistics.failed++;
-            close(s);
+    if (statistics.status[1])
+        printf(", 1xx = %d", statistics.status[1]);
 
-            if (bench_params.post.file) {
-                rlen = strlen(multipart_initial);
-                memcpy(req, multipart_initial, rlen);
-                multipart_first = 0;
+    if (statistics.status[0])
+        printf(", invalid = %d", statistics.status[0]);
 
-                fseek(bench_params.post.file, 0L, SEEK_SET);
-            }
+    printf(".\n");
+}
 
-            continue;
+/*
+ * What every --urls entry (what is "request") or every address of the
+ * server ("address") got, summed over the n workers.
+ */
+static void report_details(const entry_stats_t *stats, int n, int count, const char *what)
+{
+    int i, j, succeeded, failed, total = 0;
+    unsigned long long sum, max;
+    const entry_stats_t *e;
+
+    for (i = 0; i < n * count; i++)
+        total += stats[i].succeeded + stats[i].failed;
+
+    printf("\n  share  successful   failed   mean ms    max ms  %s\n", what);
+    for (j = 0; j < count; j++) {
+        succeeded = failed = 0;
+        sum = max = 0;
+        for (i = 0; i < n; i++) {
+            e = &stats[i * count + j];
+            succeeded += e->succeeded;
+            failed += e->failed;
+            sum += e->sum;
+            if (e->max > max)
+                max = e->max;
         }
 
-        if (bench_params.post.post) {
-            statistics.bytes += rlen;
-        }
+        printf("%6.2f%% %11d %8d %9.3f %9.3f  %s%s%s\n",
+            total ? 100.0 * (succeeded + failed) / total : 0.0,
+            succeeded, failed,
+            succeeded ? sum / 1000.0 / succeeded : 0.0,
+            max / 1000.0,
+            stats == entry_stats ? method_names[requests[j].method] : "",
+            stats == entry_stats ? " " : "",
+            stats == entry_stats ? requests[j].url : targets[j].name);
+    }
+}
 
-        if (bench_params.post.in_file && !feof(bench_params.post.file)) {
-retry:
-            r = fread(req, sizeof (char), REQUEST_SIZE, bench_params.post.file);
-            if (r < REQUEST_SIZE) {
-                if (timerexpired) {
-                    close_post_file();
-                    continue;
-                }
+/* the --ramp stages of a worker, or of an agent, added to stage_totals */
+static void stages_add(const entry_stats_t *stats)
+{
+    int j;
+
+    for (j = 0; j < nstages; j++) {
+        stage_totals[j].succeeded += stats[j].succeeded;
+        stage_totals[j].failed += stats[j].failed;
+        stage_totals[j].sum += stats[j].sum;
+        if (stats[j].max > stage_totals[j].max)
+            stage_totals[j].max = stats[j].max;
+    }
+}
 
-                if (ferror(bench_params.post.file)) {
-                    fprintf(stderr, "Error in fread, child: %d.\n", getpid());
-                    clearerr(bench_params.post.file);
-                    close_post_file();
+/* the --ramp stages of the n workers, summed into stage_totals */
+static void stages_sum(const entry_stats_t *stats, int n)
+{
+    int i;
 
-                    if (reread)
-                        break;
+    stage_totals = (entry_stats_t *)calloc(nstages, sizeof(entry_stats_t));
+    if (stage_totals == NULL) {
+        fprintf(stderr, "Error in alloc for stages, not reported.\n");
+        return;
+    }
 
-                    if ((bench_params.post.file = fopen(bench_params.post.content, "r")) == NULL) {
-                        fprintf(stderr, "Error in fopen %s, child: %d.\n", bench_params.post.content, getpid());
-                        break;
-                    }
+    for (i = 0; i < n; i++)
+        stages_add(&stats[i * nstages]);
+}
 
-                    /* socket is ok */
-                    fseek(bench_params.post.file, bench_params.post.offset, SEEK_CUR);
-                    reread = 1;
-                    goto retry;
-                } else {
-                    reread = 0;
+/* what every --ramp stage got, the requests counted by when they ended */
+static void report_stages(void)
+{
+    int j;
+    char name[128];
+    const entry_stats_t *e;
+
+    if (stage_totals == NULL)
+        return;
+
+    printf("\n  req/sec  successful   failed   mean ms    max ms  stage\n");
+    for (j = 0; j < nstages; j++) {
+        e = &stage_totals[j];
+        ramp_name(name, sizeof(name), &stages[j], ramp_rate);
+        printf("%9.1f %11d %8d %9.3f %9.3f  %s\n",
+            (e->succeeded + e->failed) / ((stages[j].end - stages[j].start) / 1e6),
+            e->succeeded, e->failed,
+            e->succeeded ? e->sum / 1000.0 / e->succeeded : 0.0,
+            e->max / 1000.0,
+            name);
+    }
+}
 
-                    /* eof */
-                    if (feof(bench_params.post.file))
-                        eof = 1;
-                }
-            }
+static const char *http_version_names[] = {
+    "0.9", "1.0", "1.1"
+};
 
-            if (r > 0) {
-                bench_params.post.offset += r;
-                rlen = r;
-                continue;
-            }
-        }
+static void output_name(output_t *o, const char *name)
+{
+    if (o->format == OUTPUT_CSV) {
+        fprintf(o->file, "%s%s,", o->prefix, name);
+        return;
+    }
 
-        if (eof) {
-            /* \r\n--boundary--\r\n */
-            bench_params.post.offset = 0;
-            bzero(request, REQUEST_SIZE);
-            sprintf(request, "\r\n--%s--\r\n", bench_params.post.boundary);
-            rlen = strlen(request);
-            eof = 0;
-            continue;
-        }
+    fprintf(o->file, "%s\n%*s\"%s\": ", o->first ? "" : ",", 2 * o->depth, "", name);
+    o->first = 0;
+}
 
-        if (bench_params.http_version == 0) {
-            if (shutdown(s, 1)) {
-                statistics.failed++;
-                close(s);
-                continue;
-            }
-        }
+/* members up to output_end() are named name.member in CSV */
+static void output_begin(output_t *o, const char *name)
+{
+    size_t len = strlen(o->prefix);
 
-        if (bench_params.force == 0) {
-            /* read all available data from socket */
-            for ( ;; ) {
-                if (timerexpired)
-                    break;
+    if (o->format == OUTPUT_CSV) {
+        snprintf(o->prefix + len, sizeof(o->prefix) - len, "%s.", name);
+        return;
+    }
 
-                i = read(s, buf, MAX_BUF_SIZE);
-                /* fprintf(stderr, "%d\n", i); */
-                if (i < 0) {
-                    statistics.failed++;
-                    close(s);
+    output_name(o, name);
+    fputc('{', o->file);
+    o->first = 1;
+    o->depth++;
+}
 
-                    if (bench_params.post.in_file) {
-                        rlen = strlen(multipart_initial);
-                        memcpy(req, multipart_initial, rlen);
-                        multipart_first = 0;
+static void output_end(output_t *o)
+{
+    char *p;
 
-                        clearerr(bench_params.post.file);
-                        fseek(bench_params.post.file, 0L, SEEK_SET);
-                    }
+    if (o->format == OUTPUT_CSV) {
+        o->prefix[strlen(o->prefix) - 1] = '\0';
+        p = strrchr(o->prefix, '.');
+        *(p ? p + 1 : o->prefix) = '\0';
+        return;
+    }
 
-                    goto nexttry;
-                } else {
-                    if (i == 0)
-                        break;
-                    else {
-                        if (!bench_params.post.post)
-                            statistics.bytes += i;
-                    }
-                }
-            }
-        }
+    o->depth--;
+    fprintf(o->file, "\n%*s}", 2 * o->depth, "");
+    o->first = 0;
+}
 
-        if (bench_params.post.in_file) {
-            rlen = strlen(multipart_initial);
-            memcpy(req, multipart_initial, rlen);
-            multipart_first = 0;
+/* NULL is null in JSON and empty in CSV */
+static void output_string(output_t *o, const char *name, const char *value)
+{
+    const char *p;
 
-            clearerr(bench_params.post.file);
-            fseek(bench_params.post.file, 0L, SEEK_SET);
-        }
+    output_name(o, name);
+
+    if (value == NULL) {
+        fputs(o->format == OUTPUT_CSV ? "\n" : "null", o->file);
+        return;
+    }
 
-        if (close(s)) {
-            statistics.failed++;
+    fputc('"', o->file);
+    for (p = value; *p; p++) {
+        /* CSV doubles quotes, JSON escapes them */
+        if (o->format == OUTPUT_CSV) {
+            if (*p == '"')
+                fputc('"', o->file);
+        } else if (*p == '"' || *p == '\\') {
+            fputc('\\', o->file);
+        } else if ((unsigned char) *p < 0x20) {
+            fprintf(o->file, "\\u%04x", *p);
             continue;
         }
 
-        statistics.succeeded++;
+        fputc(*p, o->file);
     }
+
+    fputs(o->format == OUTPUT_CSV ? "\"\n" : "\"", o->file);
+}
+
+static void output_number(output_t *o, const char *name, double value)
+{
+    output_name(o, name);
+    fprintf(o->file, o->format == OUTPUT_CSV ? "%.15g\n" : "%.15g", value);
 }
 
+/*
+ * The --output file: parameters, totals, latency percentiles and the
+ * counts of every second. CSV has name,value lines first, then after an
+ * empty line a table of the seconds.
+ */
+static int write_output(const histogram_t *h, const histogram_t *handshakes, const histogram_t *phases,
+    const sampler_t *sp)
+{
+    int i;
+    char proxy[MAXHOSTNAMELEN + 16], no[16];
+    const entry_stats_t *e;
+    output_t out = { output_file, bench_params.output, 1, 1, "" };
+    output_t *o = &out;
+    static const char *classes[] = { "invalid", "1xx", "2xx", "3xx", "4xx", "5xx" };
+
+    if (o->format == OUTPUT_JSON)
+        fputc('{', o->file);
+    else
+        fprintf(o->file, "name,value\n");
+
+    output_string(o, "version", PROGRAM_VERSION);
+
+    output_begin(o, "params");
+    output_string(o, "url", bench_params.url);
+    output_string(o, "urls", bench_params.urls);
+    output_string(o, "method", bench_params.urls ? NULL : method_names[bench_params.method]);
+    output_string(o, "http_version", http_version_names[bench_params.http_version]);
+    output_number(o, "clients", bench_params.clients);
+    output_number(o, "time", bench_params.benchtime);
+    output_string(o, "engine", engine_names[bench_params.engine]);
+    output_number(o, "workers", bench_params.engine == ENGINE_FORK ? bench_params.clients : bench_params.workers);
+    output_number(o, "keepalive", bench_params.keepalive);
+    output_number(o, "pipeline", bench_params.pipeline);
+    output_number(o, "rate", bench_params.rate);
+    output_string(o, "ramp", bench_params.ramp);
+    output_number(o, "force", bench_params.force);
+    output_number(o, "reload", bench_params.force_reload);
+    output_number(o, "resolve_every", bench_params.resolve_every);
+    output_number(o, "tls_reuse", bench_params.tls_reuse);
+    output_string(o, "cpus", bench_params.cpus);
+    output_string(o, "avoid_cpus", bench_params.avoid_cpus);
+    output_number(o, "pin", bench_params.pin);
+    output_number(o, "any_status", bench_params.any_status);
+    output_number(o, "interval", bench_params.interval);
+    output_number(o, "connect_timeout_ms", bench_params.connect_timeout);
+    output_number(o, "response_timeout_ms", bench_params.response_timeout);
+
+    if (bench_params.proxy.proxyhost != NULL)
+        snprintf(proxy, sizeof(proxy), strchr(bench_params.proxy.proxyhost, ':') ? "[%s]:%d" : "%s:%d",
+            bench_params.proxy.proxyhost, bench_params.proxy.proxyport);
+
+    output_string(o, "proxy", bench_params.proxy.proxyhost ? proxy : NULL);
+    output_string(o, "post", bench_params.post.post && !bench_params.post.in_file ? bench_params.post.content : NULL);
+    output_string(o, "file", bench_params.post.in_file ? bench_params.post.content : NULL);
+
+    output_begin(o, "headers");
+    for (i = 0; bench_params.header.key != NULL && i < bench_params.header.count; i++)
+        output_string(o, bench_params.header.key[i], bench_params.header.value[i]);
+    output_end(o);
+    output_end(o);
+
+    output_begin(o, "totals");
+    output_number(o, "succeeded", statistics.succeeded);
+    output_number(o, "failed", statistics.failed);
+    output_number(o, "timed_out", statistics.timedout);
+    output_number(o, "bytes", statistics.bytes);
+    output_number(o, "requests_per_sec", (double) (statistics.succeeded + statistics.failed) / bench_params.benchtime);
+    output_number(o, "bytes_per_sec", (double) statistics.bytes / bench_params.benchtime);
+
+    output_begin(o, "status");
+    for (i = 0; i < 6; i++)
+        output_number(o, classes[i], statistics.status[i]);
+    output_end(o);
+    output_end(o);
+
+    output_begin(o, "latency_ms");
+    output_number(o, "min", h->total ? h->min / 1000.0 : 0);
+    output_number(o, "mean", h->total ? h->sum / 1000.0 / h->total : 0);
+    output_number(o, "p50", histogram_percentile(h, 50.0) / 1000.0);
+    output_number(o, "p90", histogram_percentile(h, 90.0) / 1000.0);
+    output_number(o, "p99", histogram_percentile(h, 99.0) / 1000.0);
+    output_number(o, "p99.9", histogram_percentile(h, 99.9) / 1000.0);
+    output_number(o, "max", h->max / 1000.0);
+    output_end(o);
+
+    output_begin(o, "phases_ms");
+    for (i = 0; i < PHASES; i++) {
+        output_begin(o, phase_names[i]);
+        output_number(o, "count", phases[i].total);
+        output_number(o, "mean", phases[i].total ? phases[i].sum / 1000.0 / phases[i].total : 0);
+        output_number(o, "p50", histogram_percentile(&phases[i], 50.0) / 1000.0);
+        output_number(o, "p90", histogram_percentile(&phases[i], 90.0) / 1000.0);
+        output_number(o, "p99", histogram_percentile(&phases[i], 99.0) / 1000.0);
+        output_number(o, "max", phases[i].max / 1000.0);
+        output_end(o);
+    }
+    output_end(o);
+
+    if (bench_params.tls) {
+        output_begin(o, "tls_handshakes");
+        for (i = 0; i < 2; i++) {
+            output_begin(o, i ? "resumed" : "full");
+            output_number(o, "count", handshakes[i].total);
+            output_number(o, "mean_ms", handshakes[i].total ? handshakes[i].sum / 1000.0 / handshakes[i].total : 0);
+            output_number(o, "p50_ms", histogram_percentile(&handshakes[i], 50.0) / 1000.0);
+            output_number(o, "p99_ms", histogram_percentile(&handshakes[i], 99.0) / 1000.0);
+            output_number(o, "max_ms", handshakes[i].max / 1000.0);
+            output_end(o);
+        }
+
+        output_end(o);
+    }
+
+    if (stage_totals) {
+        output_begin(o, "stages");
+        for (i = 0; i < nstages; i++) {
+            e = &stage_totals[i];
+            snprintf(no, sizeof(no), "%d", i + 1);
+            output_begin(o, no);
+            output_number(o, "start", stages[i].start / 1e6);
+            output_number(o, "end", stages[i].end / 1e6);
+            output_number(o, ramp_rate ? "rate_from" : "clients_from", stages[i].from);
+            output_number(o, ramp_rate ? "rate_to" : "clients_to", stages[i].to);
+            output_number(o, "succeeded", e->succeeded);
+            output_number(o, "failed", e->failed);
+            output_number(o, "requests_per_sec", (e->succeeded + e->failed) / ((stages[i].end - stages[i].start) / 1e6));
+            output_number(o, "mean_ms", e->succeeded ? e->sum / 1000.0 / e->succeeded : 0);
+            output_number(o, "max_ms", e->max / 1000.0);
+            output_end(o);
+        }
+
+        output_end(o);
+    }
+
+    if (o->format == OUTPUT_JSON) {
+        fprintf(o->file, ",\n  \"series\": [");
+        for (i = 0; i < sp->nseries; i++)
+            fprintf(o->file, "%s\n    { \"second\": %d, \"succeeded\": %d, \"failed\": %d, \"bytes\": %ld }",
+                i ? "," : "", i + 1, sp->series[i].succeeded, sp->series[i].failed, sp->series[i].bytes);
+
+        fprintf(o->file, "%s]\n}\n", sp->nseries ? "\n  " : "");
+    } else {
+        fprintf(o->file, "\nsecond,succeeded,failed,bytes\n");
+        for (i = 0; i < sp->nseries; i++)
+            fprintf(o->file, "%d,%d,%d,%ld\n", i + 1, sp->series[i].succeeded, sp->series[i].failed, sp->series[i].bytes);
+    }
+
+    if (ferror(o->file) | fclose(o->file)) {
+        fprintf(stderr, "Error in writing %s.\n", bench_params.output_file);
+        return 3;
+    }
+
+    return 0;
+}
+
+/* monotonic clock in usec, for latencies */
+static unsigned long long now_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* what the workers counted so far, they may still be running */
+static void shards_sum(statistics_t *sum, int n)
+{
+    int i, j;
+
+    memset(sum, 0, sizeof(*sum));
+
+    for (i = 0; i < n; i++) {
+        sum->succeeded += STAT_GET(shards[i].stats.succeeded);
+        sum->failed += STAT_GET(shards[i].stats.failed);
+        sum->timedout += STAT_GET(shards[i].stats.timedout);
+        sum->bytes += STAT_GET(shards[i].stats.bytes);
+        for (j = 0; j < 6; j++)
+            sum->status[j] += STAT_GET(shards[i].stats.status[j]);
+    }
+}
+
+/* the histograms of the n shards, once the workers are done */
+static void shards_merge(histogram_t *latency, histogram_t *handshakes, histogram_t *phases, int n)
+{
+    int i, j;
+
+    histogram_init(latency);
+    histogram_init(&handshakes[0]);
+    histogram_init(&handshakes[1]);
+    for (j = 0; j < PHASES; j++)
+        histogram_init(&phases[j]);
+
+    for (i = 0; i < n; i++) {
+        histogram_merge(latency, &shards[i].latency);
+        /* reading them would allocate their pages, one shard per client with fork */
+        if (bench_params.tls) {
+            histogram_merge(&handshakes[0], &shards[i].handshakes[0]);
+            histogram_merge(&handshakes[1], &shards[i].handshakes[1]);
+        }
+        for (j = 0; j < PHASES; j++)
+            histogram_merge(&phases[j], &shards[i].phases[j]);
+    }
+}
+
+/* the workers start counting at start, usec */
+static void sampler_init(sampler_t *sp, unsigned long long start)
+{
+    memset(sp, 0, sizeof(*sp));
+    sp->start = start;
+    sp->at = sp->start;
+    sp->shown_at = sp->start;
+    sp->every = bench_params.interval * 1000000ULL;
+
+    /* an agent sends its seconds to the coordinator instead */
+    if (bench_params.output || agent_fd >= 0) {
+        sp->series = (sample_t *)calloc(bench_params.benchtime, sizeof(sample_t));
+        if (sp->series != NULL)
+            sp->every = 1000000;
+        else
+            fprintf(stderr, "Error in alloc for time series, not written.\n");
+    }
+
+    sp->next = sp->start + sp->every;
+}
+
+/*
+ * Sleep until the next sample is due. -1 if a signal came first, or
+ * without sleeping when there is none within the benchmark time.
+ */
+static int sampler_wait(sampler_t *sp)
+{
+    struct timespec ts;
+
+    if (sp->every == 0 || sp->next > sp->start + bench_params.benchtime * 1000000ULL)
+        return -1;
+
+    ts.tv_sec = sp->next / 1000000;
+    ts.tv_nsec = sp->next % 1000000 * 1000;
+
+    return clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ? -1 : 0;
+}
+
+/*
+ * Counts of the n shards since the previous sample, kept as a second of
+ * the series, and every --interval seconds printed as rates.
+ */
+static void sampler_sample(sampler_t *sp, int n)
+{
+    statistics_t sum;
+    sample_t *p;
+    unsigned long long now = now_usec();
+    unsigned long long elapsed = sp->next - sp->start;
+    double secs;
+
+    shards_sum(&sum, n);
+
+    if (sp->series && sp->nseries < bench_params.benchtime) {
+        p = &sp->series[sp->nseries++];
+        p->succeeded = sum.succeeded - sp->last.succeeded;
+        p->failed = sum.failed - sp->last.failed;
+        p->bytes = sum.bytes - sp->last.bytes;
+        if (agent_fd >= 0 && agent_send(agent_fd, AGENT_SAMPLE, p, sizeof(*p)))
+            perror("send to coordinator failed.");
+    }
+
+    sp->last = sum;
+    sp->at = now;
+    sp->next += sp->every;
+
+    if (bench_params.interval == 0 || elapsed % (bench_params.interval * 1000000ULL))
+        return;
+
+    secs = (now - sp->shown_at) / 1e6;
+    printf("%5ds: %ld requests/sec, %ld failed/sec, %ld bytes/sec.\n",
+        (int) (elapsed / 1000000),
+        (long) ((sum.succeeded - sp->shown.succeeded) / secs),
+        (long) ((sum.failed - sp->shown.failed) / secs),
+        (long) ((sum.bytes - sp->shown.bytes) / secs));
+    fflush(stdout);
+
+    sp->shown = sum;
+    sp->shown_at = now;
+}
+
+static void sampler_free(sampler_t *sp)
+{
+    free(sp->series);
+    sp->series = NULL;
+}
+
+static void setup_alarm(void)
+{
+    struct sigaction sa;
+
+    /* setup alarm signal handler */
+    sa.sa_handler = alarm_handler;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(SIGALRM, &sa, NULL))
+        exit(3);
+
+    /* a peer resetting one of many connections must not kill the worker */
+    signal(SIGPIPE, SIG_IGN);
+
+    alarm(bench_params.benchtime);
+}
+
+static void raise_nofile_limit(rlim_t want)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl))
+        return;
+
+    if (rl.rlim_cur >= want)
+        return;
+
+    rl.rlim_cur = (rl.rlim_max != RLIM_INFINITY && rl.rlim_max < want) ? rl.rlim_max : want;
+    if (setrlimit(RLIMIT_NOFILE, &rl) || rl.rlim_cur < want)
+        fprintf(stderr, "Warning: open files limit %ld is too low for %ld clients per worker.\n",
+            (long) rl.rlim_cur, (long) want);
+}
+
+/*
+ * Worker no goes to its CPU with --pin, before it touches its memory:
+ * the kernel then allocates the pages on the NUMA node of that CPU, for
+ * its shard as for the rest. The shard is left as mmap() zeroed it, so
+ * only the pages of the buckets it records into are ever allocated.
+ */
+static void worker_place(int no)
+{
+    cpu_set_t one;
+    int cpu = cpus_nth(&cpuset, no);
+
+    if (bench_params.pin && cpu >= 0) {
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        if (sched_setaffinity(0, sizeof(one), &one))
+            fprintf(stderr, "Warning: pinning worker no. %d to CPU %d failed.\n", no, cpu);
+    }
+}
+
+/* epfd < 0 makes a worker for blocking sockets, driven by benchcore(), or for a ring */
+static worker_t *worker_new(const char *host, const int port, const request_t *req, int nconns, int epfd)
+{
+    int i;
+    worker_t *w;
+    struct epoll_event ev;
+
+    w = (worker_t *)calloc(1, sizeof(worker_t));
+    if (w == NULL)
+        return NULL;
+
+    /* room for the largest request with fields, pipelined */
+    for (i = 0; i < nrequests; i++) {
+        if (req[i].nfields && (req[i].head.len + req[i].body.len) * bench_params.pipeline > w->text_size)
+            w->text_size = (req[i].head.len + req[i].body.len) * bench_params.pipeline;
+    }
+
+    if (w->text_size) {
+        w->texts = (char *)malloc(nconns * w->text_size);
+        w->iovs = (struct iovec *)malloc(nconns * REQUEST_IOVS * bench_params.pipeline * sizeof(struct iovec));
+    }
+
+    w->conns = (conn_t *)calloc(nconns, sizeof(conn_t));
+    w->idle = (conn_t **)malloc(nconns * sizeof(conn_t *));
+    w->iov = (struct iovec *)malloc(REQUEST_IOVS * bench_params.pipeline * sizeof(struct iovec));
+    if (epfd >= 0) {
+        w->nevents = nconns < 1024 ? nconns : 1024;
+        w->events = (struct epoll_event *)malloc(w->nevents * sizeof(struct epoll_event));
+    }
+
+    if (w->conns == NULL || w->idle == NULL || w->iov == NULL || (epfd >= 0 && w->events == NULL)
+        || (w->text_size && (w->texts == NULL || w->iovs == NULL))) {
+        free(w->texts);
+        free(w->iovs);
+        free(w->iov);
+        free(w->events);
+        free(w->conns);
+        free(w->idle);
+        free(w);
+        return NULL;
+    }
+
+    w->epfd = epfd;
+    w->nconns = nconns;
+    w->host = host;
+    w->port = port;
+    w->req = req;
+    w->timerfd = -1;
+
+    /* different in every process and thread, never 0 */
+    w->rng = (now_usec() << 20 ^ (uint64_t) getpid() << 40 ^ (uintptr_t) w) | 1;
+
+    /* of this process; the thread engine gives each worker its own */
+    if (shard != NULL) {
+        w->stats = &shard->stats;
+        w->latency = &shard->latency;
+        w->handshakes = shard->handshakes;
+        w->phases = shard->phases;
+        w->next_target = (shard - shards) % ntargets;
+    }
+
+    w->entries = entry_stat;
+    w->targets = target_stat;
+    w->stages = stage_stat;
+    w->active = nconns;
+
+    /* this worker's share of the rate, a pipelined batch counts as many */
+    if (bench_params.rate > 0)
+        w->interval = 1e6 * bench_params.clients * bench_params.pipeline / (bench_params.rate * nconns);
+
+    /* wakes epoll_wait() right at a slot, its own timeout is in msec */
+    if (w->interval && epfd >= 0) {
+        w->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        ev.events = EPOLLIN;
+        ev.data.ptr = w;
+        if (w->timerfd >= 0 && epoll_ctl(epfd, EPOLL_CTL_ADD, w->timerfd, &ev)) {
+            close(w->timerfd);
+            w->timerfd = -1;
+        }
+    }
+
+    for (i = 0; i < nconns; i++) {
+        w->conns[i].fd = -1;
+        w->idle[w->nidle++] = &w->conns[i];
+    }
+
+    return w;
+}
+
+/* closes what is left open, the counters stay where w->stats points */
+static void worker_free(worker_t *w)
+{
+    int i;
+
+    /* the direct descriptors of the uring engine go with its ring */
+    for (i = 0; i < w->nconns; i++) {
+        if (w->conns[i].fd >= 0 && w->ring == NULL)
+            conn_release(&w->conns[i]);
+    }
+
+    if (w->ring) {
+        uring_free(w->ring);
+        free(w->ring);
+    }
+
+    if (w->bufs)
+        munmap(w->bufs, (size_t) w->nconns * URING_BUF_SIZE);
+
+    free(w->msgs);
+
+    if (w->session)
+        SSL_SESSION_free(w->session);
+
+    if (w->timerfd >= 0)
+        close(w->timerfd);
+
+    if (w->epfd >= 0)
+        close(w->epfd);
+
+    free(w->events);
+    free(w->texts);
+    free(w->iovs);
+    free(w->iov);
+    free(w->idle);
+    free(w->conns);
+    free(w);
+}
+
+/*
+ * Start the --rate schedule of worker no of count: the workers take
+ * turns, so their requests do not all go out at the same moments.
+ */
+static void worker_pace(worker_t *w, int no, int count)
+{
+    w->no = no;
+    w->count = count;
+    w->base = now_usec() + (unsigned long long) (w->interval * no / count);
+    w->scheduled = 0;
+    w->next = w->base;
+}
+
+/*
+ * Follow the --ramp schedule to now: the clients of this worker that
+ * may run, or with rates its share of the rate, until the value changes.
+ */
+static void worker_ramp(worker_t *w, unsigned long long now)
+{
+    double v;
+    int clients;
+
+    if (nstages == 0 || now < w->ramp_until)
+        return;
+
+    v = ramp_value(stages, nstages, run_start, now, &w->ramp_until);
+    w->stage = ramp_stage(stages, nstages, now > run_start ? now - run_start : 0);
+
+    if (!ramp_rate) {
+        /* spread evenly among the workers, as -c is */
+        clients = (int) (v + 0.5);
+        w->active = clients / w->count + (w->no < clients % w->count);
+        return;
+    }
+
+    if (v <= 0) {
+        w->active = 0;
+        return;
+    }
+
+    w->interval = 1e6 * bench_params.clients * bench_params.pipeline / (v * w->nconns);
+
+    /*
+     * After a stop the workers take turns again. Otherwise a slot keeps
+     * its time, requests waiting for a client still count as late, unless
+     * it is further away than the new rate has it.
+     */
+    if (w->active == 0)
+        w->next = now + (unsigned long long) (w->interval * w->no / w->count);
+    else if (w->next > now + w->interval)
+        w->next = now + (unsigned long long) w->interval;
+
+    w->base = w->next;
+    w->scheduled = 0;
+    w->active = w->nconns;
+}
+
+/* more clients run than --ramp allows now, the one done with a request stops */
+static int worker_over(worker_t *w)
+{
+    if (nstages == 0)
+        return 0;
+
+    worker_ramp(w, now_usec());
+
+    return w->nconns - (w->epfd >= 0 || w->ring ? w->nidle : 0) > w->active;
+}
+
+/* the --urls entry of the next request, drawn by weight */
+static const request_t *worker_pick(worker_t *w)
+{
+    if (nrequests == 1)
+        return w->req;
+
+    return &w->req[alias_pick(&picker, fast_rand(&w->rng))];
+}
+
+/*
+ * Start time of a request beginning now. With --rate it is the slot the
+ * request was scheduled for, even if no client was free back then, so
+ * the time it waited for one counts into its latency.
+ */
+static unsigned long long worker_take(worker_t *w)
+{
+    unsigned long long slot = w->next;
+
+    if (w->interval == 0)
+        return now_usec();
+
+    w->scheduled++;
+    w->next = w->base + (unsigned long long) (w->scheduled * w->interval);
+
+    return slot;
+}
+
+/* change the events a connection waits for, only noted by benchcore() */
+static int conn_want(worker_t *w, conn_t *c, uint32_t events)
+{
+    struct epoll_event ev;
+
+    if (c->events == events)
+        return 0;
+
+    ev.events = events;
+    ev.data.ptr = c;
+    if (w->epfd >= 0 && epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev))
+        return -1;
+
+    c->events = events;
+    return 0;
+}
+
+/* (re)start the timeout of what the connection does now, msec from now; 0 stops it */
+static void conn_timer(worker_t *w, conn_t *c, int msec)
+{
+    if (msec)
+        wheel_add(&w->wheel, &c->timer, now_usec() + msec * 1000ULL);
+    else
+        wheel_del(&w->wheel, &c->timer);
+}
+
+/* close the socket and its TLS, if any */
+static int conn_release(conn_t *c)
+{
+    int rc;
+
+    if (c->ssl) {
+        tls_free(c->ssl);
+        c->ssl = NULL;
+    }
+
+    rc = close(c->fd);
+    c->fd = -1;
+
+    return rc;
+}
+
+/* close the connection without accounting and queue it for reconnect */
+static int conn_close(worker_t *w, conn_t *c)
+{
+    int rc;
+
+    conn_timer(w, c, 0);
+
+    /* the uring engine queues it once the close completes */
+    if (w->ring) {
+        conn_submit_close(w, c);
+        return 0;
+    }
+
+    rc = conn_release(c);
+    c->state = CONN_IDLE;
+    if (w->epfd >= 0)
+        w->idle[w->nidle++] = c;
+
+    return rc;
+}
+
+/* with ok one succeeded request that took usec, else n failed ones */
+static void entry_count(entry_stats_t *e, int ok, int n, unsigned long long usec)
+{
+    if (!ok) {
+        STAT_ADD(e->failed, n);
+        return;
+    }
+
+    STAT_ADD(e->succeeded, 1);
+    STAT_ADD(e->sum, usec);
+    if (usec > e->max)
+        STAT_SET(e->max, usec);
+}
+
+/* n requests sent on the connection failed */
+static void conn_failed(worker_t *w, conn_t *c, int n)
+{
+    if (n == 0)
+        return;
+
+    STAT_ADD(w->stats->failed, n);
+
+    if (w->entries)
+        entry_count(&w->entries[c->req - w->req], 0, n, 0);
+
+    if (w->targets)
+        entry_count(&w->targets[c->target], 0, n, 0);
+
+    if (w->stages)
+        entry_count(&w->stages[w->stage], 0, n, 0);
+}
+
+/*
+ * A response was received in full. It only counts as succeeded with a
+ * 2xx status, unless --any-status; HTTP/0.9 and --force have no status.
+ */
+static void conn_succeeded(worker_t *w, conn_t *c)
+{
+    int class = 2;
+    unsigned long long now = now_usec(), usec = now - c->start;
+
+    histogram_record(w->latency, usec);
+
+    /* a pipelined response after it is received from here on */
+    if (c->first) {
+        histogram_record(&w->phases[PHASE_RECEIVE], now - c->first);
+        c->first = now;
+    }
+
+    if (bench_params.http_version > 0 && !bench_params.force) {
+        class = http_status_class(&c->resp);
+        STAT_ADD(w->stats->status[class], 1);
+    }
+
+    if (class != 2 && !bench_params.any_status) {
+        conn_failed(w, c, 1);
+        return;
+    }
+
+    STAT_ADD(w->stats->succeeded, 1);
+
+    if (w->entries)
+        entry_count(&w->entries[c->req - w->req], 1, 1, usec);
+
+    if (w->targets)
+        entry_count(&w->targets[c->target], 1, 1, usec);
+
+    if (w->stages)
+        entry_count(&w->stages[w->stage], 1, 1, usec);
+}
+
+/*
+ * Close the connection and account the request. Pipelined requests
+ * still waiting for their response when it goes away failed as well.
+ */
+static void conn_done(worker_t *w, conn_t *c, int ok)
+{
+    if (conn_close(w, c))
+        ok = 0;
+
+    if (ok) {
+        conn_succeeded(w, c);
+        if (c->pending)
+            c->pending--;
+    } else if (c->pending == 0)
+        c->pending = 1;
+
+    conn_failed(w, c, c->pending);
+    c->pending = 0;
+}
+
+/* the connection ran out of time, its requests count as timed out */
+static void conn_timeout(worker_t *w, conn_t *c)
+{
+    STAT_ADD(w->stats->timedout, c->pending ? c->pending : 1);
+    conn_done(w, c, 0);
+}
+
+/* time out the connections whose deadline passed by now, the backed off ones may try again */
+static void worker_expire(worker_t *w, unsigned long long now)
+{
+    wheel_entry_t *e;
+    conn_t *c;
+
+    while ((e = wheel_expired(&w->wheel, now)) != NULL) {
+        c = (conn_t *) ((char *) e - offsetof(conn_t, timer));
+        if (c->state == CONN_BACKOFF) {
+            c->state = CONN_IDLE;
+            w->idle[w->nidle++] = c;
+        } else
+            conn_timeout(w, c);
+    }
+}
+
+/*
+ * A kept alive connection may be closed by the server at any moment
+ * between two requests: reconnect silently if nothing of the responses
+ * was seen yet, count a failure otherwise.
+ */
+static void conn_fail(worker_t *w, conn_t *c)
+{
+    if (c->reused && c->resp.received == 0
+        && (c->pending == 0 || c->pending == bench_params.pipeline)) {
+        c->pending = 0;
+        conn_close(w, c);
+    } else
+        conn_done(w, c, 0);
+}
+
+/*
+ * The request goes out in several writes (head, file chunks, trailer):
+ * don't let Nagle hold the last one back until the server's delayed ACK.
+ */
+static void conn_nodelay(conn_t *c)
+{
+    int one = 1;
+
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/*
+ * What the connection sends of its request c->req: the shared iovecs,
+ * or with fields its own copy of the head and body with values of every
+ * pipelined request. The copy is made only when the request changes,
+ * then only the fields are written over.
+ */
+static void conn_fill(worker_t *w, conn_t *c)
+{
+    const request_t *req = c->req;
+    size_t k = c - w->conns, len = req->head.len + req->body.len;
+    char *text = w->texts + k * w->text_size, *part[2];
+    struct iovec *iov = w->iovs + k * REQUEST_IOVS * bench_params.pipeline;
+    unsigned long long seq;
+    int i, j, n;
+
+    if (req->nfields == 0) {
+        c->piov = req->piov;
+        return;
+    }
+
+    if (c->copied != req) {
+        for (i = 0, n = 0; i < bench_params.pipeline; i++) {
+            memcpy(text + i * len, req->head.data, req->head.len);
+            if (req->body.len)
+                memcpy(text + i * len + req->head.len, req->body.data, req->body.len);
+
+            for (j = 0; j < REQUEST_IOVS; j++) {
+                if (req->iov[j].iov_len == 0)
+                    continue;
+
+                iov[n] = req->iov[j];
+                if (j < 2)
+                    iov[n].iov_base = text + i * len + (j ? req->head.len : 0);
+
+                n++;
+            }
+        }
+
+        c->copied = req;
+    }
+
+    for (i = 0; i < bench_params.pipeline; i++, text += len) {
+        /* the workers take turns, the numbers are those of the run */
+        seq = w->seq++ * w->count + w->no;
+        part[0] = text;
+        part[1] = text + req->head.len;
+        for (j = 0; j < req->nfields; j++)
+            field_fill(part[req->fields[j].part] + req->fields[j].off, &req->fields[j], seq, &w->rng);
+    }
+
+    c->piov = iov;
+}
+
+/* start the next request c->req on an open connection, with --response-timeout from now */
+static void conn_request(worker_t *w, conn_t *c)
+{
+    conn_fill(w, c);
+    conn_timer(w, c, bench_params.response_timeout);
+    c->state = CONN_WRITING;
+    c->sent = 0;
+    c->pending = 0;
+    c->resp.received = 0;
+    c->written = 0;
+    c->first = 0;
+}
+
+/* read() of the connection, through TLS with https:// */
+static ssize_t conn_recv(conn_t *c, void *buf, size_t len)
+{
+    return c->ssl ? tls_read(c->ssl, buf, len) : read(c->fd, buf, len);
+}
+
+/* write the (pipelined) request from where the last write stopped */
+static ssize_t conn_write_request(worker_t *w, conn_t *c)
+{
+    const request_t *req = c->req;
+    int k = c->sent / req->len * (req->npiov / bench_params.pipeline);
+    size_t off = c->sent % req->len, len, n;
+    struct msghdr msg;
+    unsigned int i;
+
+    while (off >= c->piov[k].iov_len)
+        off -= c->piov[k++].iov_len;
+
+    /* everything goes out in one call, a multipart file straight from its mapping */
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &c->piov[k];
+    msg.msg_iovlen = req->npiov - k;
+
+    /* a partial one resumes mid iovec, of a copy as the request is shared */
+    if (off) {
+        memcpy(w->iov, msg.msg_iov, msg.msg_iovlen * sizeof(struct iovec));
+        w->iov[0].iov_base = (char *) w->iov[0].iov_base + off;
+        w->iov[0].iov_len -= off;
+        msg.msg_iov = w->iov;
+    }
+
+    if (c->ssl == NULL)
+        return sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+
+    /* TLS takes one buffer, gathered so that it makes few records */
+    for (len = 0, i = 0; i < msg.msg_iovlen && len < MAX_BUF_SIZE; i++) {
+        n = MIN(msg.msg_iov[i].iov_len, MAX_BUF_SIZE - len);
+        memcpy(w->buf + len, msg.msg_iov[i].iov_base, n);
+        len += n;
+    }
+
+    return tls_write(c->ssl, w->buf, len);
+}
+
+/*
+ * A new connection, to the next address of the server in turn. With
+ * --resolve-every the name is looked up again and the address at the
+ * same place of the answer is taken.
+ */
+static int worker_socket(worker_t *w, conn_t *c, int nonblock)
+{
+    int i, fd;
+    struct addrinfo *res, *ai;
+
+    c->target = w->next_target;
+    w->next_target = (w->next_target + 1) % ntargets;
+
+    if (!bench_params.resolve_every)
+        return AddrSocket(targets[c->target].ai, nonblock);
+
+    res = Resolve(w->host, w->port);
+    if (res == NULL)
+        return -1;
+
+    for (ai = res, i = 0; i < targets[c->target].at && ai->ai_next != NULL; i++)
+        ai = ai->ai_next;
+
+    fd = AddrSocket(ai, nonblock);
+    freeaddrinfo(res);
+
+    return fd;
+}
+
+static void conn_connect(worker_t *w, conn_t *c)
+{
+    struct epoll_event ev;
+
+    c->connecting = now_usec();
+    c->fd = worker_socket(w, c, 1);
+    if (c->fd < 0) {
+        /* out of descriptors or the name gone: fails again if tried at once */
+        conn_failed(w, c, 1);
+        c->state = CONN_BACKOFF;
+        conn_timer(w, c, CONN_BACKOFF_MSEC);
+        return;
+    }
+
+    conn_nodelay(c);
+    conn_request(w, c);
+    conn_timer(w, c, bench_params.connect_timeout);
+    c->state = CONN_CONNECTING;
+    c->reused = 0;
+    c->events = EPOLLOUT;
+
+    ev.events = c->events;
+    ev.data.ptr = c;
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->fd, &ev))
+        conn_done(w, c, 0);
+}
+
+/* returns 1 when the whole request is written, 0 if it would block, -1 on error */
+static int conn_write(worker_t *w, conn_t *c)
+{
+    ssize_t n;
+
+    while (c->sent < c->req->len * bench_params.pipeline) {
+        if (c->sent == 0)
+            c->sending = now_usec();
+
+        n = conn_write_request(w, c);
+        if (n < 0)
+            return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+        c->sent += n;
+        if (c->req->method == METHOD_POST)
+            STAT_ADD(w->stats->bytes, n);
+    }
+
+    return 1;
+}
+
+/*
+ * Sessions the server hands out, kept by the worker of the connection
+ * for its next ones. With TLS 1.3 they come after the handshake, with
+ * the response.
+ */
+static int tls_new_session(SSL *ssl, SSL_SESSION *session)
+{
+    worker_t *w = (worker_t *)SSL_get_app_data(ssl);
+
+    if (w->session)
+        SSL_SESSION_free(w->session);
+
+    w->session = session;
+    return 1;
+}
+
+/*
+ * The TLS handshake of a new connection, timed by itself as full or
+ * resumed. Returns 1 when done, 0 while it waits for the socket, -1 on
+ * error.
+ */
+static int conn_handshake(worker_t *w, conn_t *c)
+{
+    uint32_t events = 0;
+    int rc;
+
+    if (c->ssl == NULL) {
+        c->ssl = tls_new(tls_ctx, c->fd, host);
+        if (c->ssl == NULL)
+            return -1;
+
+        SSL_set_app_data(c->ssl, w);
+        if (w->session)
+            SSL_set_session(c->ssl, w->session);
+
+        c->shake = now_usec();
+    }
+
+    rc = tls_handshake(c->ssl, &events);
+    if (rc == 0)
+        return conn_want(w, c, events) ? -1 : 0;
+
+    if (rc > 0)
+        histogram_record(&w->handshakes[SSL_session_reused(c->ssl) ? 1 : 0], now_usec() - c->shake);
+
+    return rc;
+}
+
+/* the whole request is written: wait for its responses, unless --force */
+static void conn_sent(worker_t *w, conn_t *c)
+{
+    c->written = now_usec();
+    histogram_record(&w->phases[PHASE_SEND], c->written - c->sending);
+
+    /* the uring engine has it linked to the send already */
+    if (bench_params.http_version == 0 && w->ring == NULL && shutdown(c->fd, SHUT_WR)) {
+        conn_done(w, c, 0);
+        return;
+    }
+
+    if (bench_params.force) {
+        conn_done(w, c, 1);
+        return;
+    }
+
+    c->state = CONN_READING;
+    c->pending = bench_params.pipeline;
+    http_response_init(&c->resp, c->req->method == METHOD_HEAD);
+}
+
+static void conn_writable(worker_t *w, conn_t *c)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if (c->state == CONN_CONNECTING) {
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+            conn_done(w, c, 0);
+            return;
+        }
+
+        histogram_record(&w->phases[PHASE_CONNECT], now_usec() - c->connecting);
+        c->state = CONN_HANDSHAKE;
+    }
+
+    /* connected, with TLS once the handshake is done too: the request is sent from now */
+    if (c->state == CONN_HANDSHAKE) {
+        switch (tls_ctx ? conn_handshake(w, c) : 1) {
+        case 0:
+            return;
+        case -1:
+            conn_done(w, c, 0);
+            return;
+        }
+
+        conn_timer(w, c, bench_params.response_timeout);
+        c->state = CONN_WRITING;
+    }
+
+    switch (conn_write(w, c)) {
+    case 0:
+        if (conn_want(w, c, EPOLLOUT))
+            conn_done(w, c, 0);
+
+        return;
+    case -1:
+        conn_fail(w, c);
+        return;
+    }
+
+    conn_sent(w, c);
+    if (c->state == CONN_READING && conn_want(w, c, EPOLLIN))
+        conn_done(w, c, 0);
+}
+
+/* begin the next request of a waiting client, connecting it first if needed */
+static void conn_start(worker_t *w, conn_t *c)
+{
+    c->start = worker_take(w);
+    c->req = worker_pick(w);
+    if (c->fd < 0 && w->ring) {
+        conn_submit_connect(w, c);
+        return;
+    }
+
+    if (c->fd < 0) {
+        conn_connect(w, c);
+        return;
+    }
+
+    conn_request(w, c);
+    if (w->ring)
+        conn_submit_send(w, c);
+    else
+        conn_writable(w, c);
+}
+
+/*
+ * Feed what was read to the response parser, possibly completing
+ * several pipelined responses. Returns -1 on a malformed response,
+ * 1 when no more responses are expected on this connection for now.
+ */
+static int conn_parse(worker_t *w, conn_t *c, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = http_response_parse(&c->resp, buf, len);
+        if (n < 0)
+            return -1;
+
+        if (c->resp.state != HTTP_DONE)
+            return 0;
+
+        conn_succeeded(w, c);
+        c->reused++;
+        c->pending--;
+
+        if (c->pending == 0 || !c->resp.keepalive)
+            return 1;
+
+        buf += n;
+        len -= n;
+        http_response_init(&c->resp, c->req->method == METHOD_HEAD);
+    }
+
+    return 0;
+}
+
+/*
+ * Take n bytes of the response read into buf, n <= 0 for the end of the
+ * connection or an error in errno. Returns 1 if there may be more to
+ * read right away, 0 otherwise: the connection was closed, moved on to
+ * its next request or has to wait for the socket.
+ */
+static int conn_received(worker_t *w, conn_t *c, const char *buf, ssize_t n)
+{
+    if (n > 0) {
+        /* the first byte of the response, of the first of a pipelined batch */
+        if (c->written) {
+            c->first = now_usec();
+            histogram_record(&w->phases[PHASE_WAIT], c->first - c->written);
+            c->written = 0;
+        }
+
+        if (c->req->method != METHOD_POST)
+            STAT_ADD(w->stats->bytes, n);
+
+        /* without keep-alive the response ends with the connection, parse it for its status */
+        if (!bench_params.keepalive) {
+            if (bench_params.http_version > 0 && http_response_parse(&c->resp, buf, n) < 0) {
+                conn_done(w, c, 0);
+                return 0;
+            }
+
+            return 1;
+        }
+
+        /* with keep-alive the response ends where its framing says */
+        switch (conn_parse(w, c, buf, n)) {
+        case 0:
+            return 1;
+        case -1:
+            conn_done(w, c, 0);
+            return 0;
+        }
+
+        if (c->pending || !c->resp.keepalive) {
+            /* the server is closing, unanswered requests failed */
+            conn_failed(w, c, c->pending);
+            c->pending = 0;
+            conn_close(w, c);
+            return 0;
+        }
+
+        if (worker_over(w)) {
+            /* --ramp is down to fewer clients */
+            conn_close(w, c);
+            return 0;
+        }
+
+        if (w->interval) {
+            /* keep the connection until the next slot is due */
+            conn_timer(w, c, 0);
+            c->state = CONN_IDLE;
+            if (w->epfd >= 0 || w->ring)
+                w->idle[w->nidle++] = c;
+
+            return 0;
+        }
+
+        c->start = now_usec();
+        c->req = worker_pick(w);
+        conn_request(w, c);
+        if (w->ring)
+            conn_submit_send(w, c);
+        else if (w->epfd >= 0)
+            conn_writable(w, c);
+
+        return 0;
+    }
+
+    if (n == 0) {
+        if (!bench_params.keepalive)
+            conn_done(w, c, bench_params.http_version == 0 || c->resp.state == HTTP_DONE
+                || c->resp.state == HTTP_BODY_EOF);
+        else if (c->resp.state == HTTP_BODY_EOF)
+            conn_done(w, c, 1);
+        else
+            conn_fail(w, c);
+    } else if (errno != EAGAIN && errno != EINTR)
+        conn_fail(w, c);
+
+    return 0;
+}
+
+static void conn_readable(worker_t *w, conn_t *c)
+{
+    /* read all available data from socket */
+    while (conn_received(w, c, w->buf, conn_recv(c, w->buf, MAX_BUF_SIZE))) { /* void */ }
+}
+
+/*
+ * With a timeout the socket of benchcore() is non-blocking: wait until
+ * it is ready for the next step, or its deadline passes. Returns 0 if
+ * the connection timed out or the alarm came first.
+ */
+static int conn_wait(worker_t *w, conn_t *c)
+{
+    int n, timeout;
+    unsigned long long now, next;
+    struct pollfd pfd;
+
+    if (!bench_params.connect_timeout && !bench_params.response_timeout)
+        return 1;
+
+    pfd.fd = c->fd;
+    pfd.events = c->state == CONN_READING ? POLLIN : c->state == CONN_HANDSHAKE ? c->events : POLLOUT;
+
+    while (!timerexpired) {
+        now = now_usec();
+        next = wheel_next(&w->wheel);
+        timeout = next == ~0ULL ? -1 : next <= now ? 0 : (int) ((next - now + 999) / 1000);
+        n = poll(&pfd, 1, timeout);
+        if (n > 0 || (n < 0 && errno != EINTR))
+            return 1;
+
+        worker_expire(w, now_usec());
+        if (c->state == CONN_IDLE)
+            return 0;
+    }
+
+    return 0;
+}
+
+/*
+ * One client with a blocking socket: the same cycle as the epoll
+ * engine, each step simply waits until it is complete.
+ */
+void benchcore(const char *host, const int port, const request_t *req, int no)
+{
+    conn_t *c;
+    worker_t *w;
+    struct timespec ts;
+
+    w = worker_new(host, port, req, 1, -1);
+    if (w == NULL) {
+        fprintf(stderr, "Error in alloc for worker, child: %d.\n", getpid());
+        exit(3);
+    }
+
+    c = &w->conns[0];
+    setup_alarm();
+    worker_pace(w, no, bench_params.clients);
+
+    while (!timerexpired) {
+        switch (c->state) {
+        case CONN_IDLE:
+            if (nstages)
+                worker_ramp(w, now_usec());
+
+            if (w->active == 0 || (nstages && w->interval && w->ramp_until < w->next)) {
+                /* not running in this stage of --ramp, or it changes first; the alarm interrupts */
+                ts.tv_sec = w->ramp_until / 1000000;
+                ts.tv_nsec = w->ramp_until % 1000000 * 1000;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+                continue;
+            }
+
+            if (w->interval) {
+                /* sleep until the slot of the next request, the alarm interrupts */
+                ts.tv_sec = w->next / 1000000;
+                ts.tv_nsec = w->next % 1000000 * 1000;
+                if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+                    continue;
+            }
+
+            c->start = worker_take(w);
+            c->req = worker_pick(w);
+            if (c->fd >= 0) {
+                conn_request(w, c);
+                break;
+            }
+
+            /* timeouts need a connect() that does not block */
+            c->connecting = now_usec();
+            c->fd = worker_socket(w, c, bench_params.connect_timeout || bench_params.response_timeout);
+            if (c->fd < 0) {
+                if (!timerexpired)
+                    conn_failed(w, c, 1);
+
+                /* before trying again, the alarm interrupts */
+                ts.tv_sec = 0;
+                ts.tv_nsec = CONN_BACKOFF_MSEC * 1000000L;
+                nanosleep(&ts, NULL);
+                continue;
+            }
+
+            conn_nodelay(c);
+            conn_request(w, c);
+            conn_timer(w, c, bench_params.connect_timeout);
+            c->state = CONN_CONNECTING;
+            c->reused = 0;
+            break;
+        case CONN_CONNECTING:
+        case CONN_HANDSHAKE:
+        case CONN_WRITING:
+            if (conn_wait(w, c))
+                conn_writable(w, c);
+
+            break;
+        case CONN_READING:
+            if (conn_wait(w, c))
+                conn_readable(w, c);
+
+            break;
+        }
+    }
+
+    worker_free(w);
+}
+
+/*
+ * (Re)start the clients that finished or failed, as the schedules allow.
+ * Returns how long the worker may wait for its connections then, usec:
+ * until the next --rate slot, --ramp change or timeout, a second at most.
+ */
+static unsigned long long worker_schedule(worker_t *w)
+{
+    int i, n;
+    unsigned long long now = now_usec(), next, wait = 1000000;
+    struct itimerspec its;
+
+    worker_ramp(w, now);
+    for (n = w->nidle, w->nidle = 0, i = 0; i < n && (w->interval == 0 || w->next <= now)
+        && w->nconns - (n - i) - w->nidle < w->active; i++)
+        conn_start(w, w->idle[i]);
+
+    /* the rest waits for its slot, behind the ones requeued just now */
+    while (i < n)
+        w->idle[w->nidle++] = w->idle[i++];
+
+    /* unless --ramp holds the idle ones back */
+    if (w->nidle && w->nconns - w->nidle < w->active) {
+        if (w->interval == 0)
+            wait = 0;
+        else if (w->timerfd < 0)
+            wait = w->next - now;
+        else if (w->armed != w->next) {
+            memset(&its, 0, sizeof(its));
+            its.it_value.tv_sec = w->next / 1000000;
+            its.it_value.tv_nsec = w->next % 1000000 * 1000;
+            if (timerfd_settime(w->timerfd, TFD_TIMER_ABSTIME, &its, NULL) == 0)
+                w->armed = w->next;
+            else
+                wait = w->next - now;
+        }
+    }
+
+    /* or --ramp changes its value */
+    if (nstages && w->ramp_until - now < wait)
+        wait = w->ramp_until - now;
+
+    /* or a connection times out */
+    next = wheel_next(&w->wheel);
+    if (next <= now)
+        wait = 0;
+    else if (next - now < wait)
+        wait = next - now;
+
+    return wait;
+}
+
+/*
+ * Drives the clients of a worker from one epoll loop: each connection
+ * runs the same connect, write, read cycle as benchcore(), but never
+ * blocks the others.
+ */
+static void worker_run(worker_t *w)
+{
+    int i, n, timeout;
+    unsigned long long expirations;
+    conn_t *c;
+
+    while (!timerexpired) {
+        timeout = (int) ((worker_schedule(w) + 999) / 1000);
+        n = epoll_wait(w->epfd, w->events, w->nevents, timeout);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            perror("epoll_wait failed.");
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            c = (conn_t *)w->events[i].data.ptr;
+
+            /* the thread engine's stop event */
+            if (c == NULL)
+                return;
+
+            /* the --rate timer, the slot is taken at the top of the loop */
+            if ((void *) c == (void *) w) {
+                if (read(w->timerfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+                    perror("read from timer failed.");
+
+                continue;
+            }
+
+            /* kept alive for the next slot, but the server gave up on it */
+            if (c->state == CONN_IDLE) {
+                conn_release(c);
+                continue;
+            }
+
+            if (c->state == CONN_READING)
+                conn_readable(w, c);
+            else
+                conn_writable(w, c);
+        }
+
+        if (w->wheel.count)
+            worker_expire(w, now_usec());
+    }
+}
+
+void benchcore_epoll(const char *host, const int port, const request_t *req, int nconns, int no)
+{
+    worker_t *w;
+
+    raise_nofile_limit(nconns + 16);
+
+    w = worker_new(host, port, req, nconns, epoll_create1(0));
+    if (w == NULL || w->epfd < 0) {
+        fprintf(stderr, "Error in epoll setup, child: %d.\n", getpid());
+        exit(3);
+    }
+
+    setup_alarm();
+    worker_pace(w, no, bench_params.workers);
+    worker_run(w);
+
+    worker_free(w);
+}
+
+#ifdef HAVE_URING
+
+/*
+ * Why the uring engine can not run here, NULL if it can: it needs a
+ * kernel whose io_uring makes sockets (Linux 5.19), and leaves TLS and
+ * --resolve-every to the epoll engine.
+ */
+static const char *uring_missing(void)
+{
+    static const int ops[] = {
+        IORING_OP_SOCKET, IORING_OP_CONNECT, IORING_OP_SENDMSG, IORING_OP_READ_FIXED,
+        IORING_OP_RECV, IORING_OP_SHUTDOWN, IORING_OP_CLOSE
+    };
+    unsigned features = IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_CQE_SKIP;
+    uring_t u;
+    int ok;
+
+    if (bench_params.tls)
+        return "No TLS with io_uring";
+
+    if (bench_params.resolve_every)
+        return "No --resolve-every with io_uring";
+
+    if (uring_init(&u, 8, 16))
+        return "No io_uring available";
+
+    ok = (u.features & features) == features && uring_supports(&u, ops, sizeof(ops) / sizeof(ops[0]));
+    uring_free(&u);
+
+    return ok ? NULL : "No sockets in the io_uring of this kernel";
+}
+
+/* the next submission of the uring engine, op on the direct descriptor of the connection */
+static struct io_uring_sqe *conn_sqe(worker_t *w, conn_t *c, int opcode, int op)
+{
+    struct io_uring_sqe *sqe = uring_sqe(w->ring);
+
+    sqe->opcode = opcode;
+    sqe->fd = c - w->conns;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->user_data = URING_DATA(w, c, op);
+
+    return sqe;
+}
+
+/* queue a read of the response into the connection's part of the buffers */
+static void conn_submit_recv(worker_t *w, conn_t *c)
+{
+    struct io_uring_sqe *sqe;
+
+    if (uring_room(w->ring, 1)) {
+        conn_done(w, c, 0);
+        return;
+    }
+
+    sqe = conn_sqe(w, c, w->fixed_bufs ? IORING_OP_READ_FIXED : IORING_OP_RECV, URING_RECV);
+    sqe->addr = (uintptr_t) (w->bufs + (size_t) (c - w->conns) * URING_BUF_SIZE);
+    sqe->len = URING_BUF_SIZE;
+    sqe->buf_index = 0;
+
+    c->busy = 1;
+}
+
+/*
+ * Queue the (pipelined) request, all of it in one SENDMSG, and linked
+ * to it the first read of the response, unless --force. Linked, the
+ * operations on the socket run in order, and all of them are done by
+ * the time the read completes.
+ */
+static void conn_submit_send(worker_t *w, conn_t *c)
+{
+    struct msghdr *msg = &w->msgs[c - w->conns];
+    struct io_uring_sqe *sqe;
+
+    if (uring_room(w->ring, 3)) {
+        conn_done(w, c, 0);
+        return;
+    }
+
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_iov = c->piov;
+    msg->msg_iovlen = c->req->npiov;
+
+    /* the kernel sends the rest of a partial one itself */
+    sqe = conn_sqe(w, c, IORING_OP_SENDMSG, URING_SEND);
+    sqe->addr = (uintptr_t) msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+
+    c->sending = now_usec();
+    c->busy = 1;
+    if (bench_params.force)
+        return;
+
+    sqe->flags |= IOSQE_IO_LINK;
+    if (bench_params.http_version == 0) {
+        /* HTTP/0.9 ends the request with the writing side */
+        sqe = conn_sqe(w, c, IORING_OP_SHUTDOWN, URING_SHUTDOWN);
+        sqe->len = SHUT_WR;
+        sqe->flags |= IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+    }
+
+    conn_submit_recv(w, c);
+}
+
+/*
+ * A new connection of the uring engine: its socket is made right into
+ * the slot of the connection in the table of direct descriptors, then
+ * connected and sent the request, a chain of linked operations going to
+ * the kernel at once.
+ */
+static void conn_submit_connect(worker_t *w, conn_t *c)
+{
+    const struct addrinfo *ai;
+    struct io_uring_sqe *sqe;
+
+    c->target = w->next_target;
+    w->next_target = (w->next_target + 1) % ntargets;
+    ai = targets[c->target].ai;
+
+    c->connecting = now_usec();
+    if (uring_room(w->ring, 5)) {
+        conn_failed(w, c, 1);
+        w->idle[w->nidle++] = c;
+        return;
+    }
+
+    c->fd = c - w->conns;
+    conn_request(w, c);
+    conn_timer(w, c, bench_params.connect_timeout);
+    c->state = CONN_CONNECTING;
+    c->reused = 0;
+
+    /* a failure of one cancels the rest of the chain, up to the read */
+    sqe = conn_sqe(w, c, IORING_OP_SOCKET, URING_SOCKET);
+    sqe->fd = ai->ai_family;
+    sqe->off = ai->ai_socktype;
+    sqe->len = ai->ai_protocol;
+    sqe->file_index = c->fd + 1;
+    sqe->flags = IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+
+    sqe = conn_sqe(w, c, IORING_OP_CONNECT, URING_CONNECT);
+    sqe->addr = (uintptr_t) ai->ai_addr;
+    sqe->off = ai->ai_addrlen;
+    sqe->flags |= IOSQE_IO_LINK;
+
+    conn_submit_send(w, c);
+}
+
+/*
+ * Close the direct descriptor of the connection, shutting the socket
+ * down first if an operation still waits on it. Completions of before
+ * are stale from now on, the connection is queued for reconnect on that
+ * of the close.
+ */
+static void conn_submit_close(worker_t *w, conn_t *c)
+{
+    struct io_uring_sqe *sqe;
+
+    c->gen++;
+    c->state = CONN_CLOSING;
+
+    /* without room a new socket of the connection replaces it in the table */
+    if (uring_room(w->ring, 2)) {
+        c->fd = -1;
+        c->state = CONN_IDLE;
+        w->idle[w->nidle++] = c;
+        return;
+    }
+
+    if (c->busy) {
+        sqe = conn_sqe(w, c, IORING_OP_SHUTDOWN, URING_SHUTDOWN);
+        sqe->len = SHUT_RDWR;
+        sqe->flags |= IOSQE_IO_HARDLINK | IOSQE_CQE_SKIP_SUCCESS;
+        c->busy = 0;
+    }
+
+    sqe = conn_sqe(w, c, IORING_OP_CLOSE, URING_CLOSE);
+    sqe->fd = 0;
+    sqe->flags = 0;
+    sqe->file_index = c->fd + 1;
+}
+
+/* the completion of op of the uring engine with result res, as user_data has it */
+static void conn_complete(worker_t *w, uint64_t data, int res)
+{
+    conn_t *c = &w->conns[data >> 32];
+
+    if ((data >> 8 & 0xffffff) != (c->gen & 0xffffff))
+        return;
+
+    /* with a failure the rest of a chain is cancelled */
+    if (res < 0)
+        c->busy = 0;
+
+    switch (data & 0xff) {
+    case URING_SOCKET:
+        /* completes only when it failed */
+        conn_done(w, c, 0);
+        break;
+    case URING_CONNECT:
+        if (res < 0) {
+            conn_done(w, c, 0);
+            break;
+        }
+
+        c->sending = now_usec();
+        histogram_record(&w->phases[PHASE_CONNECT], c->sending - c->connecting);
+        conn_timer(w, c, bench_params.response_timeout);
+        c->state = CONN_WRITING;
+        break;
+    case URING_SEND:
+        /* a short one fails the link too, the read is the one in flight otherwise */
+        if (res < 0 || (size_t) res < c->req->len * bench_params.pipeline) {
+            c->busy = 0;
+            conn_fail(w, c);
+            break;
+        }
+
+        c->busy = !bench_params.force;
+        c->sent = res;
+        if (c->req->method == METHOD_POST)
+            STAT_ADD(w->stats->bytes, res);
+
+        conn_sent(w, c);
+        break;
+    case URING_RECV:
+        c->busy = 0;
+        if (res < 0) {
+            errno = -res;
+            res = -1;
+        }
+
+        conn_received(w, c, w->bufs + (size_t) (c - w->conns) * URING_BUF_SIZE, res);
+        if (c->state == CONN_READING)
+            conn_submit_recv(w, c);
+
+        break;
+    case URING_SHUTDOWN:
+        /* completes only when it failed, which does not matter for a close */
+        if (c->state == CONN_READING)
+            conn_done(w, c, 0);
+
+        break;
+    case URING_CLOSE:
+        c->fd = -1;
+        c->state = CONN_IDLE;
+        w->idle[w->nidle++] = c;
+        break;
+    }
+}
+
+/*
+ * The loop of the uring engine, the cycle of worker_run(): what all
+ * connections do next is queued in the submission ring and goes to the
+ * kernel in one system call, the one that waits for what completed.
+ */
+static void worker_run_uring(worker_t *w)
+{
+    struct io_uring_cqe *cqe;
+    uint64_t data;
+    int res;
+
+    while (!timerexpired) {
+        if (uring_enter(w->ring, worker_schedule(w)) < 0 && errno != ETIME && errno != EINTR
+            && errno != EBUSY) {
+            perror("io_uring_enter failed.");
+            break;
+        }
+
+        while ((cqe = uring_cqe(w->ring)) != NULL) {
+            data = cqe->user_data;
+            res = cqe->res;
+            uring_seen(w->ring);
+            conn_complete(w, data, res);
+        }
+
+        if (w->wheel.count)
+            worker_expire(w, now_usec());
+    }
+}
+
+/*
+ * The ring of a worker of the uring engine, with a direct descriptor and
+ * a part of one buffer for each connection. The buffer is registered
+ * with the ring if the locked memory allows, or read into with RECV.
+ */
+static int worker_uring(worker_t *w)
+{
+    /* at least the chain of a connect, socket to recv */
+    unsigned entries = w->nconns < 2 ? 8 : w->nconns < 1024 ? w->nconns * 4 : 4096;
+    unsigned cq_entries = w->nconns < 8192 ? w->nconns * 8 : 65536;
+    size_t size = (size_t) w->nconns * URING_BUF_SIZE;
+    struct iovec iov;
+    int i, rc, *fds;
+
+    w->ring = (uring_t *)malloc(sizeof(uring_t));
+    w->msgs = (struct msghdr *)calloc(w->nconns, sizeof(struct msghdr));
+    w->bufs = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (w->bufs == MAP_FAILED)
+        w->bufs = NULL;
+
+    if (w->ring == NULL || w->msgs == NULL || w->bufs == NULL)
+        return -1;
+
+    if (uring_init(w->ring, entries, cq_entries)) {
+        free(w->ring);
+        w->ring = NULL;
+        return -1;
+    }
+
+    /* all empty, the sockets are made into them */
+    fds = (int *)malloc(w->nconns * sizeof(int));
+    if (fds == NULL)
+        return -1;
+
+    for (i = 0; i < w->nconns; i++)
+        fds[i] = -1;
+
+    rc = uring_register(w->ring, IORING_REGISTER_FILES, fds, w->nconns);
+    free(fds);
+    if (rc)
+        return -1;
+
+    iov.iov_base = w->bufs;
+    iov.iov_len = size;
+    w->fixed_bufs = uring_register(w->ring, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+
+    return 0;
+}
+
+void benchcore_uring(const char *host, const int port, const request_t *req, int nconns, int no)
+{
+    worker_t *w;
+
+    raise_nofile_limit(nconns + 16);
+
+    w = worker_new(host, port, req, nconns, -1);
+    if (w == NULL || worker_uring(w)) {
+        fprintf(stderr, "Error in io_uring setup, child: %d: %s.\n", getpid(), strerror(errno));
+        exit(3);
+    }
+
+    setup_alarm();
+    worker_pace(w, no, bench_params.workers);
+    worker_run_uring(w);
+
+    worker_free(w);
+}
+
+#else /* HAVE_URING */
+
+/* the io_uring headers of the build are older than Linux 5.19 */
+static const char *uring_missing(void)
+{
+    return "Built without io_uring";
+}
+
+/* with no engine no worker has a ring, and these are never called */
+static void conn_submit_connect(worker_t *w, conn_t *c)
+{
+    (void) w;
+    (void) c;
+}
+
+static void conn_submit_send(worker_t *w, conn_t *c)
+{
+    (void) w;
+    (void) c;
+}
+
+static void conn_submit_close(worker_t *w, conn_t *c)
+{
+    (void) w;
+    (void) c;
+}
+
+void benchcore_uring(const char *host, const int port, const request_t *req, int nconns, int no)
+{
+    benchcore_epoll(host, port, req, nconns, no);
+}
+
+#endif /* HAVE_URING */
+
+static void *worker_thread(void *arg)
+{
+    worker_run((worker_t *) arg);
+    return NULL;
+}
+
+/*
+ * The thread engine: the workers of the epoll engine run as threads
+ * sharing the request, the POST file and the target, and each counts
+ * into its own shard. The shards are summed once all threads are done.
+ */
+static int bench_threads(const char *host, const int port)
+{
+    int i, n = bench_params.workers, started = 0, stopfd = -1, rc = 3;
+    uint64_t one = 1;
+    worker_t **workers = NULL;
+    pthread_t *tids = NULL;
+    struct epoll_event ev;
+    sigset_t set, old;
+    histogram_t *total = NULL; /* latency, full and resumed handshakes, phases */
+    sampler_t sampler;
+
+    raise_nofile_limit(bench_params.clients + 16 * n + 16);
+
+    workers = (worker_t **)calloc(n, sizeof(worker_t *));
+    tids = (pthread_t *)calloc(n, sizeof(pthread_t));
+    total = (histogram_t *)malloc((3 + PHASES) * sizeof(histogram_t));
+    stopfd = eventfd(0, 0);
+    if (workers == NULL || tids == NULL || total == NULL || stopfd < 0) {
+        fprintf(stderr, "Error in thread engine setup.\n");
+        goto done;
+    }
+
+    /* the threads begin as they are started */
+    run_start = now_usec();
+
+    /* the workers send as soon as they start, before setup_alarm() */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* expiry is signalled to the main thread only, workers wake on stopfd */
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+
+    for (i = 0; i < n; i++) {
+        /* the thread inherits the CPU, and its memory is touched first there */
+        worker_place(i);
+
+        /* spread the clients evenly among the workers */
+        workers[i] = worker_new(host, port, requests, bench_params.clients / n + (i < bench_params.clients % n),
+            epoll_create1(0));
+        if (workers[i] == NULL || workers[i]->epfd < 0) {
+            fprintf(stderr, "Error in epoll setup, worker no. %d.\n", i);
+            break;
+        }
+
+        workers[i]->stats = &shards[i].stats;
+        workers[i]->latency = &shards[i].latency;
+        workers[i]->handshakes = shards[i].handshakes;
+        workers[i]->phases = shards[i].phases;
+        workers[i]->next_target = i % ntargets;
+        if (entry_stats)
+            workers[i]->entries = &entry_stats[i * nrequests];
+
+        if (target_stats)
+            workers[i]->targets = &target_stats[i * ntargets];
+
+        if (stage_stats)
+            workers[i]->stages = &stage_stats[i * nstages];
+
+        worker_pace(workers[i], i, n);
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(workers[i]->epfd, EPOLL_CTL_ADD, stopfd, &ev)
+            || pthread_create(&tids[i], NULL, worker_thread, workers[i])) {
+            fprintf(stderr, "problems starting worker no. %d\n", i);
+            break;
+        }
+
+        started++;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (bench_params.pin)
+        sched_setaffinity(0, sizeof(cpuset), &cpuset);
+
+    if (started == n) {
+        setup_alarm();
+        sampler_init(&sampler, run_start);
+        while (!timerexpired) {
+            if (sampler_wait(&sampler) == 0)
+                sampler_sample(&sampler, n);
+            else
+                pause();
+        }
+    }
+
+    timerexpired = 1;
+    if (write(stopfd, &one, sizeof(one)) != sizeof(one))
+        perror("write to stop event failed.");
+
+    for (i = 0; i < started; i++)
+        pthread_join(tids[i], NULL);
+
+    if (started < n)
+        goto done;
+
+    /* merge the shards, nothing runs any more */
+    shards_sum(&statistics, n);
+    shards_merge(total, total + 1, total + 3, n);
+    if (stage_stats)
+        stages_sum(stage_stats, n);
+
+    if (agent_fd >= 0)
+        agent_done(total, total + 1, total + 3);
+
+    report(total, total + 1, total + 3);
+    report_stages();
+    rc = bench_params.output ? write_output(total, total + 1, total + 3, &sampler) : 0;
+    sampler_free(&sampler);
+
+done:
+    for (i = 0; workers != NULL && i < n; i++) {
+        if (workers[i])
+            worker_free(workers[i]);
+    }
+
+    if (stopfd >= 0)
+        close(stopfd);
+
+    free(total);
+    free(tids);
+    free(workers);
+    free_boundary();
+
+    return rc;
+}
+
+/*
+ * Whether the n arguments of a run are only options agent_args() makes,
+ * followed by the URL. Whoever reaches the port of an agent may send a
+ * run: it must not name a file of the agent to read or write, nor make
+ * it an agent or a coordinator.
+ */
+static int agent_allowed(char **args, int n)
+{
+    static const char *flags[] = {
+        "-9", "-1", "-2", "--get", "--head", "--options", "--trace", "-f", "-r", "-k",
+        "--resolve-every", "--any-status", "--tls-reuse"
+    };
+    static const char *valued[] = {
+        "-o", "-t", "-c", "--engine", "--workers", "--pipeline", "--rate", "--ramp",
+        "--connect-timeout", "--response-timeout", "-p", "-d"
+    };
+    size_t j;
+    int i, known;
+
+    for (i = 0; i < n - 1; i++) {
+        for (j = 0, known = 0; j < sizeof(flags) / sizeof(flags[0]) && !known; j++)
+            known = strcmp(args[i], flags[j]) == 0;
+
+        /* with its value, which is not the URL */
+        for (j = 0; j < sizeof(valued) / sizeof(valued[0]) && !known; j++) {
+            if (strcmp(args[i], valued[j]) == 0 && i + 1 < n - 1) {
+                known = 1;
+                i++;
+            }
+        }
+
+        if (!known)
+            return 0;
+    }
+
+    return n > 0 && args[n - 1][0] != '-';
+}
+
+/*
+ * webbench --agent: takes one run at a time from a coordinator. A run is
+ * this program started again with the arguments the coordinator sent and
+ * the connection as --agent-fd; the affinity of --cpus and --avoid-cpus
+ * passes on by itself, --pin is added. Runs are not authenticated, so the
+ * agent listens on loopback unless it is given a host.
+ */
+static int agent_serve(const char *self)
+{
+    int lfd, fd, port, status, i, first;
+    char *listen_at, *host, *args = NULL, *p, **argv, fdarg[16];
+    uint32_t type;
+    size_t len;
+    pid_t pid;
+
+    listen_at = strdup(bench_params.agent);
+    port = listen_at ? HostPort(listen_at, &host) : -1;
+    if (port < 0) {
+        fprintf(stderr, "Error in option --agent %s: Bad [host]:port.\n", bench_params.agent);
+        free(listen_at);
+        return 2;
+    }
+
+    lfd = ListenSocket(host != NULL ? host : "127.0.0.1", port, 16);
+    free(listen_at);
+    if (lfd < 0) {
+        fprintf(stderr, "Error in option --agent %s: Can not listen.\n", bench_params.agent);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    printf("Agent waiting for runs on %s.\n", bench_params.agent);
+    fflush(stdout);
+
+    for ( ;; ) {
+        fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+
+            perror("accept failed.");
+            break;
+        }
+
+        /*
+         * The version comes first, then the arguments. A peer that sends
+         * nothing is dropped in time, and so is a coordinator that does not
+         * start the run: the timeout passes on to it with the connection.
+         */
+        agent_timeout(fd, AGENT_HANDSHAKE);
+        if (agent_recv(fd, &type, &args, &len) || type != AGENT_RUN || strcmp(args, PROGRAM_VERSION) != 0) {
+            fprintf(stderr, "Not a run of webbench "PROGRAM_VERSION", ignored.\n");
+            free(args);
+            close(fd);
+            continue;
+        }
+
+        argv = (char **)malloc((len + 5) * sizeof(char *));
+        if (argv == NULL) {
+            fprintf(stderr, "Error in alloc for run.\n");
+            free(args);
+            close(fd);
+            continue;
+        }
+
+        snprintf(fdarg, sizeof(fdarg), "%d", fd);
+        i = 0;
+        argv[i++] = (char *) self;
+        argv[i++] = (char *) "--agent-fd";
+        argv[i++] = fdarg;
+        if (bench_params.pin)
+            argv[i++] = (char *) "--pin";
+
+        for (first = i, p = args + strlen(args) + 1; p < args + len; p += strlen(p) + 1)
+            argv[i++] = p;
+
+        argv[i] = NULL;
+        if (!agent_allowed(argv + first, i - first)) {
+            fprintf(stderr, "Run with options an agent does not take, ignored.\n");
+            free(argv);
+            free(args);
+            args = NULL;
+            close(fd);
+            continue;
+        }
+
+        fflush(stdout);
+        pid = fork();
+        if (pid == 0) {
+            close(lfd);
+            execv("/proc/self/exe", argv);
+            perror("exec failed.");
+            _exit(3);
+        }
+
+        close(fd);
+        free(argv);
+        free(args);
+        args = NULL;
+
+        if (pid < 0) {
+            perror("fork failed.");
+            continue;
+        }
+
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) { /* void */ }
+
+        printf("\nRun done, exit code %d.\n\n", WIFEXITED(status) ? WEXITSTATUS(status) : 3);
+        fflush(stdout);
+    }
+
+    close(lfd);
+    return 3;
+}
+
+/* tells the coordinator the run is set up and waits until it says go */
+static int agent_start(void)
+{
+    uint32_t type;
+    char *data = NULL;
+    size_t len;
+    int rc = -1;
+
+    if (agent_send(agent_fd, AGENT_READY, NULL, 0) == 0
+        && agent_recv(agent_fd, &type, &data, &len) == 0 && type == AGENT_GO)
+        rc = 0;
+
+    free(data);
+    return rc;
+}
+
+/* the totals and histograms of the run, for the coordinator to merge */
+static void agent_done(const histogram_t *latency, const histogram_t *handshakes, const histogram_t *phases)
+{
+    size_t len = sizeof(agent_result_t) + nstages * sizeof(entry_stats_t);
+    agent_result_t *r = (agent_result_t *)calloc(1, len);
+
+    if (r == NULL) {
+        fprintf(stderr, "Error in alloc for results.\n");
+        return;
+    }
+
+    r->stats = statistics;
+    r->latency = *latency;
+    r->handshakes[0] = handshakes[0];
+    r->handshakes[1] = handshakes[1];
+    memcpy(r->phases, phases, sizeof(r->phases));
+
+    /* and the --ramp stages behind */
+    if (stage_totals)
+        memcpy(r + 1, stage_totals, nstages * sizeof(entry_stats_t));
+
+    if (agent_send(agent_fd, AGENT_DONE, r, len))
+        perror("send to coordinator failed.");
+
+    free(r);
+}
+
+static void agent_arg(strbuf_t *b, const char *arg)
+{
+    strbuf_append(b, arg, strlen(arg) + 1);
+}
+
+static void agent_arg_number(strbuf_t *b, const char *option, double value)
+{
+    char str[32];
+
+    snprintf(str, sizeof(str), "%.17g", value);
+    agent_arg(b, option);
+    agent_arg(b, str);
+}
+
+/* what agent no of n gets of value: clients evenly as -c, or a rate */
+static double agent_share(double value, int rate, int no, int n)
+{
+    if (rate)
+        return value / n;
+
+    return (int) value / n + (no < (int) value % n);
+}
+
+/*
+ * Whether agent no of n gets something to run of its share: clients,
+ * and of --ramp stages of clients one at least where it has any. The
+ * agent would refuse a run of none, and the whole run would abort.
+ */
+static int agent_runnable(int no, int n)
+{
+    int i;
+
+    if (agent_share(bench_params.clients, 0, no, n) < 1)
+        return 0;
+
+    for (i = 0; i < nstages && !ramp_rate; i++) {
+        if (agent_share(stages[i].from, 0, no, n) > 0 || agent_share(stages[i].to, 0, no, n) > 0)
+            return 1;
+    }
+
+    return nstages == 0 || ramp_rate;
+}
+
+/*
+ * The run for agent no of n, as the arguments of webbench that make the
+ * same bench_params_t, with its share of the clients and rate. --interval
+ * and --output stay with the coordinator; agent_allowed() takes no more.
+ */
+static void agent_args(strbuf_t *b, int no, int n)
+{
+    int i;
+    char str[MAXHOSTNAMELEN + 16];
+    static const char *versions[] = { "-9", "-1", "-2" };
+    static const char *methods[] = { "--get", "--head", "--options", "--trace" };
+
+    agent_arg(b, PROGRAM_VERSION);
+    agent_arg(b, versions[bench_params.http_version]);
+
+    if (bench_params.post.post) {
+        agent_arg(b, "-o");
+        agent_arg(b, bench_params.post.content);
+    } else if (bench_params.method < METHOD_POST)
+        agent_arg(b, methods[bench_params.method]);
+
+    if (bench_params.force)
+        agent_arg(b, "-f");
+
+    if (bench_params.force_reload)
+        agent_arg(b, "-r");
+
+    if (bench_params.keepalive)
+        agent_arg(b, "-k");
+
+    agent_arg_number(b, "-t", bench_params.benchtime);
+    agent_arg_number(b, "-c", agent_share(bench_params.clients, 0, no, n));
+    agent_arg(b, "--engine");
+    agent_arg(b, engine_names[bench_params.engine]);
+
+    if (bench_params.workers > 0)
+        agent_arg_number(b, "--workers", bench_params.workers);
+
+    if (bench_params.pipeline > 1)
+        agent_arg_number(b, "--pipeline", bench_params.pipeline);
+
+    if (bench_params.rate > 0 && nstages == 0)
+        agent_arg_number(b, "--rate", agent_share(bench_params.rate, 1, no, n));
+
+    /* every stage of --ramp shared out as well */
+    if (nstages)
+        agent_arg(b, "--ramp");
+
+    for (i = 0; i < nstages; i++) {
+        strbuf_printf(b, "%s%.17g", i ? "," : "", agent_share(stages[i].from, ramp_rate, no, n));
+        if (stages[i].to != stages[i].from)
+            strbuf_printf(b, "-%.17g", agent_share(stages[i].to, ramp_rate, no, n));
+
+        strbuf_printf(b, "%s:%llus", ramp_rate ? "/s" : "", (stages[i].end - stages[i].start) / 1000000);
+        if (i == nstages - 1)
+            strbuf_append(b, "", 1);
+    }
+
+    if (bench_params.connect_timeout)
+        agent_arg_number(b, "--connect-timeout", bench_params.connect_timeout);
+
+    if (bench_params.response_timeout)
+        agent_arg_number(b, "--response-timeout", bench_params.response_timeout);
+
+    if (bench_params.resolve_every)
+        agent_arg(b, "--resolve-every");
+
+    if (bench_params.any_status)
+        agent_arg(b, "--any-status");
+
+    if (bench_params.tls_reuse)
+        agent_arg(b, "--tls-reuse");
+
+    if (bench_params.proxy.proxyhost != NULL) {
+        snprintf(str, sizeof(str), strchr(bench_params.proxy.proxyhost, ':') ? "[%s]:%d" : "%s:%d",
+            bench_params.proxy.proxyhost, bench_params.proxy.proxyport);
+        agent_arg(b, "-p");
+        agent_arg(b, str);
+    }
+
+    for (i = 0; bench_params.header.key != NULL && i < bench_params.header.count; i++) {
+        agent_arg(b, "-d");
+        strbuf_printf(b, "%s:%s", bench_params.header.key[i], bench_params.header.value[i]);
+        strbuf_append(b, "", 1);
+    }
+
+    agent_arg(b, bench_params.url);
+}
+
+/* the --interval lines of the seconds all agents have sent */
+static void coordinator_show(const agent_t *agents, int n, const sampler_t *sp, int *shown)
+{
+    int i, k = bench_params.benchtime;
+    sample_t sum;
+
+    for (i = 0; i < n; i++) {
+        if (!agents[i].lost && agents[i].nsamples < k)
+            k = agents[i].nsamples;
+    }
+
+    while (bench_params.interval && *shown + bench_params.interval <= k) {
+        memset(&sum, 0, sizeof(sum));
+        for (i = *shown; i < *shown + bench_params.interval; i++) {
+            sum.succeeded += sp->series[i].succeeded;
+            sum.failed += sp->series[i].failed;
+            sum.bytes += sp->series[i].bytes;
+        }
+
+        *shown += bench_params.interval;
+        printf("%5ds: %ld requests/sec, %ld failed/sec, %ld bytes/sec.\n", *shown,
+            (long) sum.succeeded / bench_params.interval,
+            (long) sum.failed / bench_params.interval,
+            sum.bytes / bench_params.interval);
+        fflush(stdout);
+    }
+}
+
+/*
+ * webbench --coordinator: the run goes to every agent with its share of
+ * the clients and rate. They start together once all are set up, send
+ * the counts of every second as they go and their totals and histograms
+ * at the end, which are merged and reported as those of one run.
+ */
+static int coordinate(void)
+{
+    int i, j, n = 1, port, left, shown = 0, rc = 1;
+    unsigned long long deadline, now;
+    char *list, *p, *host, *save = NULL;
+    uint32_t type;
+    char *data;
+    size_t len;
+    agent_t *agents = NULL, *a;
+    struct pollfd *pfds = NULL;
+    sampler_t sampler;
+    strbuf_t args;
+    histogram_t total, handshakes[2], phases[PHASES];
+    const agent_result_t *r;
+
+    signal(SIGPIPE, SIG_IGN);
+    memset(&sampler, 0, sizeof(sampler));
+    memset(&statistics, 0, sizeof(statistics));
+    histogram_init(&total);
+    histogram_init(&handshakes[0]);
+    histogram_init(&handshakes[1]);
+    for (j = 0; j < PHASES; j++)
+        histogram_init(&phases[j]);
+
+    list = strdup(bench_params.coordinator);
+    for (p = list; p != NULL && *p; p++)
+        n += *p == ',';
+
+    agents = (agent_t *)calloc(n, sizeof(agent_t));
+    pfds = (struct pollfd *)calloc(n, sizeof(struct pollfd));
+    sampler.series = (sample_t *)calloc(bench_params.benchtime, sizeof(sample_t));
+    if (nstages)
+        stage_totals = (entry_stats_t *)calloc(nstages, sizeof(entry_stats_t));
+
+    if (list == NULL || agents == NULL || pfds == NULL || sampler.series == NULL
+        || (nstages && stage_totals == NULL)) {
+        fprintf(stderr, "Error in alloc for agents.\n");
+        rc = 3;
+        goto done;
+    }
+
+    for (i = 0; i < n; i++)
+        agents[i].fd = -1;
+
+    for (i = 0; i < n; i++) {
+        if (!agent_runnable(i, n)) {
+            fprintf(stderr, "Error in option --coordinator: Fewer clients than agents%s.\n",
+                nstages && !ramp_rate ? " in the stages of --ramp" : "");
+            rc = 2;
+            goto done;
+        }
+    }
+
+    for (i = 0, p = strtok_r(list, ",", &save); p != NULL; p = strtok_r(NULL, ",", &save), i++) {
+        a = &agents[i];
+        snprintf(a->name, sizeof(a->name), "%s", p);
+        port = HostPort(p, &host);
+        if (port < 0 || host == NULL) {
+            fprintf(stderr, "Error in option --coordinator %s: Bad host:port.\n", a->name);
+            rc = 2;
+            goto done;
+        }
+
+        a->fd = Socket(host, port);
+        if (a->fd < 0) {
+            fprintf(stderr, "\nConnect to agent %s failed. Aborting benchmark.\n", a->name);
+            goto done;
+        }
+
+        /* an agent that hangs fails instead of stalling the run */
+        agent_timeout(a->fd, AGENT_HANDSHAKE);
+
+        /* spread the clients evenly among the agents */
+        memset(&args, 0, sizeof(args));
+        agent_args(&args, i, n);
+        j = agent_send(a->fd, AGENT_RUN, args.data, args.len);
+        free(args.data);
+        if (j) {
+            fprintf(stderr, "\nSend to agent %s failed. Aborting benchmark.\n", a->name);
+            goto done;
+        }
+    }
+
+    /* all are set up before any starts */
+    for (i = 0; i < n; i++) {
+        j = agent_recv(agents[i].fd, &type, &data, &len) == 0 && type == AGENT_READY;
+        free(data);
+        if (!j) {
+            fprintf(stderr, "\nAgent %s could not set up the benchmark. Aborting benchmark.\n", agents[i].name);
+            goto done;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        if (agent_send(agents[i].fd, AGENT_GO, NULL, 0))
+            fprintf(stderr, "Send to agent %s failed.\n", agents[i].name);
+    }
+
+    /* the results are due by the end of the benchmark, with a margin */
+    deadline = now_usec() + (unsigned long long) (bench_params.benchtime + AGENT_GRACE) * 1000000;
+    for (left = n; left > 0; ) {
+        for (i = 0; i < n; i++) {
+            pfds[i].fd = agents[i].done ? -1 : agents[i].fd;
+            pfds[i].events = POLLIN;
+        }
+
+        now = now_usec();
+        j = now < deadline ? poll(pfds, n, (int) ((deadline - now + 999) / 1000)) : 0;
+        if (j < 0) {
+            if (errno == EINTR)
+                continue;
+
+            perror("poll failed.");
+            break;
+        }
+
+        if (j == 0) {
+            for (i = 0; i < n; i++) {
+                if (!agents[i].done) {
+                    fprintf(stderr, "Agent %s: no results in time, they are missing.\n", agents[i].name);
+                    agents[i].done = agents[i].lost = 1;
+                }
+            }
+
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            a = &agents[i];
+            if (a->done || pfds[i].revents == 0)
+                continue;
+
+            if (agent_recv(a->fd, &type, &data, &len)) {
+                fprintf(stderr, "Agent %s: connection lost, its results are missing.\n", a->name);
+                a->done = a->lost = 1;
+                left--;
+            } else if (type == AGENT_SAMPLE && len == sizeof(sample_t) && a->nsamples < bench_params.benchtime) {
+                sampler.series[a->nsamples].succeeded += ((sample_t *) data)->succeeded;
+                sampler.series[a->nsamples].failed += ((sample_t *) data)->failed;
+                sampler.series[a->nsamples++].bytes += ((sample_t *) data)->bytes;
+                if (a->nsamples > sampler.nseries)
+                    sampler.nseries = a->nsamples;
+            } else if (type == AGENT_DONE && len == sizeof(agent_result_t) + nstages * sizeof(entry_stats_t)) {
+                r = (const agent_result_t *) data;
+                a->stats = r->stats;
+                statistics.succeeded += r->stats.succeeded;
+                statistics.failed += r->stats.failed;
+                statistics.timedout += r->stats.timedout;
+                statistics.bytes += r->stats.bytes;
+                for (j = 0; j < 6; j++)
+                    statistics.status[j] += r->stats.status[j];
+
+                histogram_merge(&total, &r->latency);
+                histogram_merge(&handshakes[0], &r->handshakes[0]);
+                histogram_merge(&handshakes[1], &r->handshakes[1]);
+                for (j = 0; j < PHASES; j++)
+                    histogram_merge(&phases[j], &r->phases[j]);
+
+                if (nstages)
+                    stages_add((const entry_stats_t *) (r + 1));
+
+                a->done = 1;
+                left--;
+            }
+
+            free(data);
+        }
+
+        coordinator_show(agents, n, &sampler, &shown);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (!agents[i].lost)
+            rc = 0;
+    }
+
+    if (rc)
+        goto done;
+
+    report(&total, handshakes, phases);
+    report_stages();
+
+    printf("\n successful   failed  agent\n");
+    for (i = 0; i < n; i++)
+        printf("%11d %8d  %s%s\n", agents[i].stats.succeeded, agents[i].stats.failed, agents[i].name,
+            agents[i].lost ? " (lost)" : "");
+
+    if (bench_params.output)
+        rc = write_output(&total, handshakes, phases, &sampler);
+
+done:
+    for (i = 0; agents != NULL && i < n; i++) {
+        if (agents[i].fd >= 0)
+            close(agents[i].fd);
+    }
+
+    sampler_free(&sampler);
+    free(pfds);
+    free(agents);
+    free(list);
+
+    return rc;
+}
@@ -0,0 +1,109 @@
+/*
+ * Hashed timer wheel for the deadlines of many connections: a slot per
+ * msec tick, the slots going round once a WHEEL_SLOTS ticks. Adding and
+ * removing an entry is a few pointer writes. A deadline further away
+ * than a turn of the wheel stays in its slot and is passed over until
+ * its turn comes, as the expiry checks the deadline itself.
+ *
+ * A zeroed wheel_t and wheel_entry_t are ready for use.
+ */
+
+#define WHEEL_SLOTS 1024 /* a power of 2 */
+#define WHEEL_TICK  1000 /* usec */
+
+typedef struct wheel_entry {
+    struct wheel_entry *next;
+    struct wheel_entry **pprev; /* what points to it, NULL while not on the wheel */
+    unsigned long long deadline; /* usec */
+} wheel_entry_t;
+
+typedef struct {
+    wheel_entry_t *slots[WHEEL_SLOTS];
+    unsigned long long tick; /* the first one not expired yet */
+    int count;
+} wheel_t;
+
+void wheel_del(wheel_t *wh, wheel_entry_t *e)
+{
+    if (e->pprev == NULL)
+        return;
+
+    *e->pprev = e->next;
+    if (e->next)
+        e->next->pprev = e->pprev;
+
+    e->pprev = NULL;
+    wh->count--;
+}
+
+/* puts e on the wheel to expire at deadline, moving it if it was already */
+void wheel_add(wheel_t *wh, wheel_entry_t *e, unsigned long long deadline)
+{
+    unsigned long long tick = deadline / WHEEL_TICK;
+    wheel_entry_t **slot;
+
+    wheel_del(wh, e);
+
+    /* what is due already goes into the first slot still looked at */
+    if (tick < wh->tick)
+        tick = wh->tick;
+
+    slot = &wh->slots[tick & (WHEEL_SLOTS - 1)];
+    e->deadline = deadline;
+    e->next = *slot;
+    e->pprev = slot;
+    if (e->next)
+        e->next->pprev = &e->next;
+
+    *slot = e;
+    wh->count++;
+}
+
+/*
+ * Takes an entry whose deadline is past now off the wheel and returns it,
+ * NULL once there are none left. Called until then, as the caller may
+ * change the wheel in between.
+ */
+wheel_entry_t *wheel_expired(wheel_t *wh, unsigned long long now)
+{
+    unsigned long long tick = now / WHEEL_TICK;
+    wheel_entry_t *e;
+
+    if (wh->count == 0) {
+        wh->tick = tick;
+        return NULL;
+    }
+
+    /* one turn of the wheel looks at every entry */
+    if (tick >= wh->tick + WHEEL_SLOTS)
+        wh->tick = tick - WHEEL_SLOTS + 1;
+
+    for ( ;; wh->tick++) {
+        for (e = wh->slots[wh->tick & (WHEEL_SLOTS - 1)]; e != NULL; e = e->next) {
+            if (e->deadline <= now) {
+                wheel_del(wh, e);
+                return e;
+            }
+        }
+
+        /* entries may still come due in the current tick */
+        if (wh->tick >= tick)
+            return NULL;
+    }
+}
+
+/*
+ * When wheel_expired() may have something next, usec: the end of the
+ * tick of the first slot in use, ~0 with an empty wheel.
+ */
+unsigned long long wheel_next(const wheel_t *wh)
+{
+    unsigned long long tick;
+
+    if (wh->count == 0)
+        return ~0ULL;
+
+    for (tick = wh->tick; wh->slots[tick & (WHEEL_SLOTS - 1)] == NULL; tick++) { /* void */ }
+
+    return (tick + 1) * WHEEL_TICK;
+}